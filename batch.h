@@ -0,0 +1,203 @@
+//
+// batch.h
+// Compresses or decompresses many files in one run.  The files are spread
+// over a thread pool, largest first, so one huge file found last cannot
+// leave every other thread idle at the end.  Each worker keeps one set of
+// coding buffers (CoderBuffers in util.h) for all of its files.  A file
+// that fails is recorded and skipped; the rest of the batch goes on.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdint.h>
+#include "threadpool.h"
+#include "util.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <sys/stat.h>
+#define BATCH_HAS_DIRENT 1
+#endif
+
+using namespace std;
+
+struct BatchOptions {
+    bool decompress;     // decompress .huf files instead of compressing
+    int threads;         // 0 for one per hardware thread
+    CompressOptions compress;
+    BatchOptions() : decompress(false), threads(0) {}
+};
+
+struct BatchReport {
+    size_t files;
+    uint64_t inputBytes;    // bytes read, over the files that succeeded
+    uint64_t outputBytes;   // bytes written, over the files that succeeded
+    double seconds;
+    vector<string> failed;  // names of the files that failed
+    BatchReport() : files(0), inputBytes(0), outputBytes(0), seconds(0) {}
+};
+
+//
+// Returns the size of the file at path, or -1 if it is not a regular file.
+//
+inline int64_t _batchFileSize(const string &path) {
+#ifdef BATCH_HAS_DIRENT
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+        return -1;
+    return (int64_t)info.st_size;
+#else
+    ifstream in(path, ios::binary | ios::ate);
+    return in ? (int64_t)in.tellg() : -1;
+#endif
+}
+
+//
+// Adds the regular files under directory, at any depth, to files.
+// Symbolic links to files are listed, but links to directories are not
+// followed: one pointing back up the tree would list the same files again
+// at every level.  Returns false if directory cannot be read.
+//
+inline bool _listDirectory(const string &directory, vector<string> &files) {
+#ifdef BATCH_HAS_DIRENT
+    DIR* dir = opendir(directory.c_str());
+    if (dir == NULL)
+        return false;
+    while (struct dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        string path = directory + "/" + name;
+        struct stat info;
+        if (lstat(path.c_str(), &info) != 0)
+            continue;
+        bool link = S_ISLNK(info.st_mode);
+        if (link && stat(path.c_str(), &info) != 0)
+            continue;  // a dangling link
+        if (S_ISDIR(info.st_mode) && !link)
+            _listDirectory(path, files);
+        else if (S_ISREG(info.st_mode))
+            files.push_back(path);
+    }
+    closedir(dir);
+    return true;
+#else
+    (void)directory;
+    (void)files;
+    return false;
+#endif
+}
+
+//
+// Adds the files source names to files: every regular file under it if it
+// is a directory, otherwise source itself.
+//
+inline void addBatchSource(const string &source, vector<string> &files) {
+    if (!_listDirectory(source, files))
+        files.push_back(source);
+}
+
+//
+// Adds the names listed in listFile, one per line, to files.  Returns false
+// if listFile cannot be read.
+//
+inline bool addBatchList(const string &listFile, vector<string> &files) {
+    ifstream in(listFile);
+    if (!in)
+        return false;
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line[line.length() - 1] == '\r')
+            line.erase(line.length() - 1);
+        if (!line.empty())
+            files.push_back(line);
+    }
+    return true;
+}
+
+//
+// Compresses every file in files to file + ".huf", or with
+// options.decompress set decompresses each the way decompress does, and
+// returns what was done.  When compressing, files that already end in
+// ".huf" are skipped; when decompressing, files that do not.  Each file is
+// coded on one thread; options.threads files are coded at a time.
+//
+inline BatchReport runBatch(const vector<string> &files, const BatchOptions &options) {
+    BatchReport report;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const string suffix = ".huf";
+    // (size, name), largest first; files that cannot be stat'ed fail now
+    vector<pair<int64_t, string>> work;
+    for (size_t i = 0; i < files.size(); i++) {
+        const string &name = files[i];
+        bool isHuf = name.length() >= suffix.length()
+                  && name.compare(name.length() - suffix.length(), suffix.length(), suffix) == 0;
+        if (isHuf != options.decompress)
+            continue;
+        int64_t size = _batchFileSize(name);
+        if (size < 0)
+            report.failed.push_back(name);
+        else
+            work.push_back(make_pair(size, name));
+    }
+    sort(work.begin(), work.end(), greater<pair<int64_t, string>>());
+    report.files = work.size() + report.failed.size();
+
+    int nThreads = options.threads > 0 ? options.threads : threadpool::defaultThreads();
+    if ((size_t)nThreads > work.size())
+        nThreads = (int)max(work.size(), (size_t)1);
+    CompressOptions compressOptions = options.compress;
+    compressOptions.threads = 1;  // the files are the parallel work
+    atomic<size_t> next(0);
+    mutex lock;
+    condition_variable done;
+    int running = nThreads;
+    {
+        threadpool pool(nThreads);
+        // one task per worker, each taking the next largest file until none
+        // are left, so a worker's buffers serve all of its files
+        for (int t = 0; t < nThreads; t++) {
+            pool.submit([&]() {
+                CoderBuffers buffers;
+                string unused;
+                size_t i;
+                while ((i = next++) < work.size()) {
+                    const string &name = work[i].second;
+                    string target = options.decompress ? _decompressedName(name)
+                                                       : name + suffix;
+                    bool ok;
+                    try {
+                        ok = options.decompress
+                           ? _decompressFile(name, target, buffers, false, unused)
+                           : _compressFile(name, target, compressOptions, buffers,
+                                           false, unused);
+                    } catch (const exception&) {  // e.g. out of memory
+                        ok = false;
+                    }
+                    int64_t written = ok ? _batchFileSize(target) : -1;
+                    lock_guard<mutex> guard(lock);
+                    if (written < 0) {
+                        report.failed.push_back(name);
+                    } else {
+                        report.inputBytes += (uint64_t)work[i].first;
+                        report.outputBytes += (uint64_t)written;
+                    }
+                }
+                lock_guard<mutex> guard(lock);
+                if (--running == 0)
+                    done.notify_all();
+            });
+        }
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [&running] { return running == 0; });
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
@@ -0,0 +1,298 @@
+//
+// bench.cpp
+// End-to-end throughput benchmark for compress and decompress.  It builds
+// its own corpus in bench_corpus/ (kept between runs): repetitive text,
+// random bytes, a skewed byte distribution and log lines, each at sizes
+// from 1 KB up to --max-size (1 GB at most).  Every file is compressed and
+// decompressed --reps times; the median time gives the MB/s, measured on
+// the original size, and the round trip is checked.  Results are printed
+// as a table and written as JSON to --json (bench.json by default) so runs
+// can be compared over time.
+//
+// Usage: bench.exe [--max-size 64M] [--reps 3] [--json bench.json]
+//                  [--threads 0] [--only text]
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include "util.h"
+
+using namespace std;
+
+struct BenchResult {
+    string corpus;
+    uint64_t size;
+    uint64_t compressedSize;
+    double compressSeconds;    // median over the repetitions
+    double decompressSeconds;
+    bool roundTrip;
+};
+
+//
+// A small, fast generator, so that building a 1 GB corpus takes seconds
+// and every run builds the same bytes.
+//
+struct benchrng {
+    uint64_t state;
+    explicit benchrng(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    uint32_t below(uint32_t n) { return (uint32_t)((next() >> 32) * n >> 32); }
+};
+
+//
+// Writes size bytes of the named kind of data to out.
+//
+void generateCorpus(const string &kind, uint64_t size, ostream &out) {
+    static const char* words[] = {
+        "the", "of", "and", "to", "in", "a", "is", "that", "for", "it",
+        "as", "was", "with", "be", "by", "on", "not", "he", "this", "are",
+        "compression", "huffman", "tree", "symbol", "frequency", "encoding",
+        "stream", "block", "table", "decoder"};
+    static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    static const char* paths[] = {"/api/v1/users", "/api/v1/orders", "/health",
+                                  "/api/v2/search", "/static/app.js"};
+    benchrng rng(size ^ kind.length());
+    string buf;
+    uint64_t written = 0;
+    uint64_t line = 0;
+    while (written < size) {
+        buf.clear();
+        if (kind == "random") {
+            for (int i = 0; i < 4096; i++) {
+                buf += (char)rng.next();
+            }
+        } else if (kind == "skewed") {
+            // byte k with probability about 2^-(k+1)
+            for (int i = 0; i < 4096; i++) {
+                uint64_t r = rng.next() | (1ULL << 63);
+                buf += (char)__builtin_ctzll(r);
+            }
+        } else if (kind == "text") {
+            // short words far more often than long ones, in sentences
+            for (int i = 0; i < 12; i++) {
+                uint32_t w = rng.below(30);
+                w = rng.below(w + 1);
+                buf += words[w];
+                buf += i == 11 ? ".\n" : " ";
+            }
+        } else {  // logs
+            line++;
+            ostringstream ss;
+            ss << "2024-03-" << setw(2) << setfill('0') << 1 + line / 2000000 % 28
+               << "T" << setw(2) << line / 100000 % 24 << ":" << setw(2)
+               << line / 1000 % 60 << ":" << setw(2) << line / 10 % 60 << "."
+               << setw(3) << rng.below(1000) << "Z " << levels[rng.below(6)]
+               << " [worker-" << rng.below(16) << "] " << "GET "
+               << paths[rng.below(5)] << " status=" << (rng.below(20) ? 200 : 500)
+               << " latency_ms=" << rng.below(rng.below(1000) + 1)
+               << " request_id=" << hex << rng.next() << dec << "\n";
+            buf = ss.str();
+        }
+        size_t n = (size_t)min((uint64_t)buf.length(), size - written);
+        out.write(buf.data(), n);
+        written += n;
+    }
+}
+
+//
+// Returns the path of the corpus file of this kind and size, building it
+// first if it is not there yet.
+//
+string corpusFile(const string &kind, uint64_t size) {
+    ostringstream name;
+    name << "bench_corpus/" << kind << "_" << size << ".dat";
+    struct stat info;
+    if (stat(name.str().c_str(), &info) != 0 || (uint64_t)info.st_size != size) {
+        ofstream out(name.str().c_str(), ios::binary);
+        generateCorpus(kind, size, out);
+    }
+    return name.str();
+}
+
+//
+// Returns whether the two files have the same contents.
+//
+bool sameFile(const string &a, const string &b) {
+    mappedfile fa(a), fb(b);
+    return fa.is_open() && fb.is_open() && fa.size() == fb.size()
+        && (fa.size() == 0 || memcmp(fa.data(), fb.data(), fa.size()) == 0);
+}
+
+//
+// Returns the median of times.
+//
+double median(vector<double> times) {
+    sort(times.begin(), times.end());
+    size_t n = times.size();
+    return n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+}
+
+//
+// Compresses and decompresses the corpus file of this kind and size reps
+// times with options, and returns the result.
+//
+BenchResult runOne(const string &kind, uint64_t size, int reps,
+                   const CompressOptions &options) {
+    string filename = corpusFile(kind, size);
+    BenchResult result;
+    result.corpus = kind;
+    result.size = size;
+    vector<double> compressTimes, decompressTimes;
+    bool ok = true;
+    for (int r = 0; r < reps; r++) {
+        bool compressed, decompressed;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        compress(filename, false, options, nullptr, &compressed);
+        chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+        decompress(filename + ".huf", false, nullptr, &decompressed);
+        chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+        compressTimes.push_back(chrono::duration<double>(t1 - t0).count());
+        decompressTimes.push_back(chrono::duration<double>(t2 - t1).count());
+        ok = ok && compressed && decompressed;
+    }
+    result.compressSeconds = median(compressTimes);
+    result.decompressSeconds = median(decompressTimes);
+    mappedfile compressed(filename + ".huf");
+    result.compressedSize = compressed.size();
+    string decoded = _decompressedName(filename + ".huf");
+    result.roundTrip = ok && sameFile(filename, decoded);
+    remove(decoded.c_str());
+    remove((filename + ".huf").c_str());
+    return result;
+}
+
+//
+// Parses a size such as 4096, 64K, 16M or 1G.
+//
+uint64_t parseSize(const string &text) {
+    uint64_t value = strtoull(text.c_str(), NULL, 10);
+    char unit = text.empty() ? 0 : (char)toupper(text[text.length() - 1]);
+    if (unit == 'K')
+        value <<= 10;
+    else if (unit == 'M')
+        value <<= 20;
+    else if (unit == 'G')
+        value <<= 30;
+    return value;
+}
+
+//
+// Returns size as the bench table shows it, e.g. 64K.
+//
+string sizeName(uint64_t size) {
+    ostringstream ss;
+    if (size >= (1 << 30))
+        ss << (size >> 30) << "G";
+    else if (size >= (1 << 20))
+        ss << (size >> 20) << "M";
+    else
+        ss << (size >> 10) << "K";
+    return ss.str();
+}
+
+//
+// Returns the throughput of coding size bytes in seconds.
+//
+double mbPerSecond(uint64_t size, double seconds) {
+    return seconds > 0 ? size / seconds / 1e6 : 0;
+}
+
+//
+// Writes the results and the settings they were measured with as JSON.
+//
+void writeJson(ostream &out, const vector<BenchResult> &results,
+               const CompressOptions &options, int reps) {
+    out << "{\n  \"reps\": " << reps << ",\n  \"threads\": " << options.threads
+        << ",\n  \"blockSize\": " << options.blockSize << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        out << "    {\"corpus\": \"" << r.corpus << "\", \"size\": " << r.size
+            << ", \"compressedSize\": " << r.compressedSize
+            << ", \"ratio\": " << (r.size ? (double)r.compressedSize / r.size : 0)
+            << ", \"compressSeconds\": " << r.compressSeconds
+            << ", \"decompressSeconds\": " << r.decompressSeconds
+            << ", \"compressMBps\": " << mbPerSecond(r.size, r.compressSeconds)
+            << ", \"decompressMBps\": " << mbPerSecond(r.size, r.decompressSeconds)
+            << ", \"roundTrip\": " << (r.roundTrip ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+//
+// Prints how to run the benchmark and returns the exit code for a bad
+// command line.
+//
+int usage() {
+    cerr << "usage: bench.exe [--max-size 64M] [--reps 3] [--json bench.json]\n"
+            "                 [--threads 0] [--only text|random|skewed|logs]" << endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    uint64_t maxSize = 64 << 20;
+    int reps = 3;
+    string jsonFile = "bench.json";
+    string only;
+    CompressOptions options;
+    for (int i = 1; i < argc; i += 2) {
+        string arg = argv[i];
+        if (i + 1 == argc)
+            return usage();  // every flag takes a value
+        if (arg == "--max-size")
+            maxSize = min(parseSize(argv[i + 1]), (uint64_t)1 << 30);
+        else if (arg == "--reps")
+            reps = max(1, atoi(argv[i + 1]));
+        else if (arg == "--json")
+            jsonFile = argv[i + 1];
+        else if (arg == "--threads")
+            options.threads = atoi(argv[i + 1]);
+        else if (arg == "--only")
+            only = argv[i + 1];
+        else
+            return usage();
+    }
+    mkdir("bench_corpus", 0755);
+    const char* kinds[] = {"text", "random", "skewed", "logs"};
+    vector<BenchResult> results;
+    bool allOk = true;
+    cout << left << setw(8) << "corpus" << right << setw(6) << "size" << setw(9)
+         << "ratio" << setw(14) << "compress" << setw(14) << "decompress" << endl;
+    for (int k = 0; k < 4; k++) {
+        if (!only.empty() && only != kinds[k])
+            continue;
+        // 1 KB, then every factor of 16 up to the limit
+        for (uint64_t size = 1 << 10; size <= maxSize; size <<= 4) {
+            BenchResult r = runOne(kinds[k], size, reps, options);
+            results.push_back(r);
+            allOk = allOk && r.roundTrip;
+            cout << left << setw(8) << r.corpus << right << setw(6) << sizeName(r.size)
+                 << setw(9) << fixed << setprecision(4)
+                 << (double)r.compressedSize / r.size << setprecision(1)
+                 << setw(9) << mbPerSecond(r.size, r.compressSeconds) << " MB/s"
+                 << setw(9) << mbPerSecond(r.size, r.decompressSeconds) << " MB/s"
+                 << (r.roundTrip ? "" : "  ROUND TRIP FAILED") << endl;
+            if (size << 4 > maxSize && size < maxSize)
+                size = maxSize >> 4;  // end on the limit itself
+        }
+    }
+    ofstream json(jsonFile.c_str());
+    writeJson(json, results, options, reps);
+    cout << "Wrote " << jsonFile << endl;
+    return allOk ? 0 : 1;
+}
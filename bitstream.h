@@ -33,6 +33,9 @@
 #include <ostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
 
 /**
  * Constant: PSEUDO_EOF
@@ -71,6 +74,368 @@ inline void SetNthBit(int n, int & inByte) {
     inByte |= (1 << n);
 }
 
+/*
+ * Function: StoreLE64
+ * -------------------
+ * Stores the 64-bit word v at p in little-endian byte order, which is the
+ * byte order the LSB-first bit layout above produces for a whole word.
+ */
+inline void StoreLE64(unsigned char* p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, &v, sizeof(v));
+#else
+    for (int i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+#endif
+}
+
+/*
+ * Function: LoadLE64
+ * ------------------
+ * Loads the little-endian 64-bit word at p; the inverse of StoreLE64.
+ */
+inline uint64_t LoadLE64(const unsigned char* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+#else
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+#endif
+}
+
+/**
+ * Defines a buffered bit writer.  Bits are packed LSB-first (the same layout
+ * as SetNthBit) into a 64-bit accumulator, whole words of which are stored
+ * into a byte buffer.  The buffer is handed to the sink stream in large
+ * blocks; if there is no sink, the bytes simply accumulate in memory and can
+ * be retrieved with data() and size().  The buffer is only allocated once
+ * the first word is stored.
+ */
+class bitwriter {
+public:
+    /* Constructor bitwriter::bitwriter
+     * --------------------------------
+     * "acc" holds the pending bits, "nacc" how many of them are valid.
+     * "buf" is the byte buffer and "used" the number of bytes stored in it.
+     */
+    explicit bitwriter(std::ostream* sink = NULL)
+        : sink(sink), acc(0), nacc(0), used(0) {}
+    /**
+     * Creates a bit writer that flushes to sink, or keeps everything in
+     * memory if sink is NULL.
+     */
+
+    /* Member function bitwriter::writeBits
+     * ------------------------------------
+     * Whole bytes are only moved out of the accumulator when the new bits
+     * would not fit, so the common case is one shift and one or.
+     */
+    void writeBits(uint64_t value, int nbits) {
+        if (nbits <= 0) {
+            return;
+        }
+        if (nacc + nbits > 64) {
+            drain();
+        }
+        acc |= (value & (~0ULL >> (64 - nbits))) << nacc;
+        nacc += nbits;
+    }
+    /**
+     * Appends the low nbits bits of value, least significant bit first.
+     * nbits must be at most 57.
+     */
+
+    /* Member function bitwriter::seed
+     * -------------------------------
+     * Used to continue a byte that was partially written by someone else.
+     */
+    void seed(int byte, int nbits) {
+        acc = (uint64_t)(byte & ((1 << nbits) - 1));
+        nacc = nbits;
+    }
+    /**
+     * Starts the accumulator with the low nbits bits of byte.  Only valid
+     * while the accumulator is empty.
+     */
+
+    /* Member function bitwriter::flush
+     * --------------------------------
+     * Drains all whole bytes and hands the buffer to the sink.  Fewer than
+     * eight bits can remain in the accumulator afterwards.
+     */
+    void flush() {
+        while (nacc >= NUM_BITS_IN_BYTE) {
+            drain();
+        }
+        if (sink && used > 0) {
+            emit();
+        }
+    }
+    /**
+     * Writes every complete byte to the sink and returns with at most seven
+     * pending bits, which can be read with pendingBits() / pendingCount().
+     */
+
+    /* Member function bitwriter::finish
+     * ---------------------------------
+     * Pads the final partial byte with zero bits.
+     */
+    void finish() {
+        if (nacc % NUM_BITS_IN_BYTE != 0) {
+            nacc += NUM_BITS_IN_BYTE - nacc % NUM_BITS_IN_BYTE;
+        }
+        flush();
+    }
+    /**
+     * Pads the output to a byte boundary and flushes it.
+     */
+
+    int pendingBits() const { return (int)acc; }
+    int pendingCount() const { return nacc; }
+    void clearPending() { acc = 0; nacc = 0; }
+
+    /**
+     * Returns the buffered bytes of an in-memory writer.
+     */
+    const unsigned char* data() const { return buf.empty() ? NULL : &buf[0]; }
+    size_t size() const { return used; }
+
+    /**
+     * Empties an in-memory writer so its buffer can be reused.
+     */
+    void reset() {
+        acc = 0;
+        nacc = 0;
+        used = 0;
+    }
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 16;
+
+    /* Member function bitwriter::drain
+     * --------------------------------
+     * Stores the whole accumulator word and advances by the number of
+     * complete bytes in it; the rest stay in the accumulator.
+     */
+    void drain() {
+        if (buf.size() - used < sizeof(uint64_t)) {
+            if (buf.empty()) {
+                buf.resize(BLOCK_SIZE + sizeof(uint64_t));
+            } else if (sink) {
+                emit();
+            } else {
+                buf.resize(2 * buf.size());
+            }
+        }
+        int nbytes = nacc / NUM_BITS_IN_BYTE;
+        StoreLE64(&buf[used], acc);
+        used += nbytes;
+        acc = nbytes == 8 ? 0 : acc >> (nbytes * NUM_BITS_IN_BYTE);
+        nacc -= nbytes * NUM_BITS_IN_BYTE;
+    }
+
+    /* Member function bitwriter::emit
+     * -------------------------------
+     * Goes to the sink's buffer directly rather than through write, whose
+     * sentry would first flush the stream the sink is tied to; for an
+     * obitstream that is the sink itself, in the middle of writing bits.
+     */
+    void emit() {
+        if (sink->rdbuf() == NULL
+            || sink->rdbuf()->sputn((const char*)&buf[0], used) != (std::streamsize)used) {
+            sink->setstate(std::ios::badbit);
+        }
+        used = 0;
+    }
+
+    std::ostream* sink;
+    uint64_t acc;
+    int nacc;
+    std::vector<unsigned char> buf;
+    size_t used;
+};
+
+/**
+ * Defines a buffered bit reader, the counterpart of bitwriter.  Bits are
+ * taken LSB-first (the same layout as GetNthBit) from a 64-bit refill
+ * register that is topped up a whole word at a time from a byte buffer.  The
+ * bytes come either from a span of memory or, in large blocks, from a source
+ * stream.  Past the end of the data the register reads as zero bits.
+ */
+class bitreader {
+public:
+    /* Constructor bitreader::bitreader
+     * --------------------------------
+     * "acc" is the refill register and "nacc" the number of valid bits in it.
+     * "next" and "end" delimit the bytes not yet moved into the register.
+     */
+    explicit bitreader(std::istream* source = NULL)
+        : source(source), next(NULL), end(NULL), acc(0), nacc(0) {
+    }
+    /**
+     * Creates a bit reader that pulls its bytes from source, or that reads
+     * nothing until setSpan is called if source is NULL.
+     */
+
+    /* Member function bitreader::setSpan
+     * ----------------------------------
+     * Points the reader at memory owned by the caller; nothing is copied.
+     */
+    void setSpan(const unsigned char* begin, const unsigned char* stop) {
+        next = begin;
+        end = stop;
+        acc = 0;
+        nacc = 0;
+    }
+    /**
+     * Reads the bytes in [begin, stop) from the first bit on.
+     */
+
+    /* Member function bitreader::refill
+     * ---------------------------------
+     * With eight bytes in the buffer we load a whole word and keep as many
+     * whole bytes of it as fit; the bits above those are the same bits the
+     * next load will put there, so they need not be masked off.  Near the
+     * end of the buffer we fall back to single bytes.
+     */
+    void refill() {
+        while (nacc <= 56) {
+            if (end - next >= 8) {
+                acc |= LoadLE64(next) << nacc;
+                next += (63 - nacc) >> 3;
+                nacc |= 56;
+                return;
+            }
+            if (next == end && !underflow()) {
+                return;
+            }
+            acc |= (uint64_t)*next++ << nacc;
+            nacc += NUM_BITS_IN_BYTE;
+        }
+    }
+    /**
+     * Tops the register up to at least 56 bits, unless the data runs out.
+     */
+
+    /* Member function bitreader::peekBits
+     * -----------------------------------
+     * Only refills when the register is short, so runs of small peeks cost
+     * a compare, a mask and a shift each.
+     */
+    uint64_t peekBits(int n) {
+        if (nacc < n) {
+            refill();
+        }
+        return acc & (~0ULL >> (64 - n));
+    }
+    /**
+     * Returns the next n bits (1 to 56) without consuming them; the first
+     * bit is in the least significant position.
+     */
+
+    /* Member function bitreader::consume
+     * ----------------------------------
+     * Consuming more than is buffered can only happen on the zero padding
+     * past the end of the data; it leaves the register empty.
+     */
+    void consume(int n) {
+        if (n > nacc) {
+            acc = 0;
+            nacc = 0;
+            return;
+        }
+        acc >>= n;
+        nacc -= n;
+    }
+    /**
+     * Discards the next n bits, which should have been looked at with
+     * peekBits first.
+     */
+
+    uint64_t readBits(int n) {
+        uint64_t bits = peekBits(n);
+        consume(n);
+        return bits;
+    }
+    /**
+     * Reads and consumes the next n bits (1 to 56).
+     */
+
+    /* Member function bitreader::available
+     * ------------------------------------
+     * Refills first, so this is exact whenever fewer than 56 bits remain.
+     */
+    int available() {
+        refill();
+        return nacc;
+    }
+    /**
+     * Returns the number of bits buffered in the register, which is 0 only
+     * at the end of the data.
+     */
+
+    bool hasBits() {
+        return available() > 0;
+    }
+    /**
+     * Returns whether any bits remain to be read.
+     */
+
+    /* Member function bitreader::seed
+     * -------------------------------
+     * Used to continue a byte that was partially read by someone else.
+     */
+    void seed(int bits, int nbits) {
+        acc = (uint64_t)(bits & ((1 << nbits) - 1));
+        nacc = nbits;
+    }
+    /**
+     * Starts the register with the low nbits bits of bits.  Only valid
+     * while the register is empty.
+     */
+
+    void clear() {
+        next = end = NULL;
+        acc = 0;
+        nacc = 0;
+    }
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 16;
+
+    /* Member function bitreader::underflow
+     * ------------------------------------
+     * Reads the next block of the source stream into the buffer.
+     */
+    bool underflow() {
+        if (source == NULL) {
+            return false;
+        }
+        buf.resize(BLOCK_SIZE);
+        source->read((char*)&buf[0], BLOCK_SIZE);
+        std::streamsize got = source->gcount();
+        if (got <= 0) {
+            return false;
+        }
+        next = &buf[0];
+        end = next + got;
+        return true;
+    }
+
+    std::istream* source;
+    const unsigned char* next;
+    const unsigned char* end;
+    uint64_t acc;
+    int nacc;
+    std::vector<unsigned char> buf;
+};
+
 class ibitstream: public std::istream {
 public:
     /* Constructor ibitstream::ibitstream
@@ -82,8 +447,10 @@ public:
      * "pos" is the bit position within curByte that is next to read
      * We set initial state for lastTell and curByte to 0, then pos is
      * set at 8 so that next readBit will trigger a fresh read.
+     * "reader" serves readBits/peekBits/consume once they have been used.
      */
-    ibitstream() : std::istream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE) {
+    ibitstream() : std::istream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE),
+                   reader(this), buffering(false) {
         this->fake = false;
     }
     /**
@@ -110,6 +477,9 @@ public:
             } else {
                 return 1;
             }
+        } else if (buffering) {
+            // the stream has already been read ahead into the buffer
+            return reader.available() > 0 ? (int)reader.readBits(1) : EOF;
         } else {
             // if just finished bits from curByte or if data read from stream after last readBit()
             if (lastTell != tellg() || pos == NUM_BITS_IN_BYTE) {
@@ -131,6 +501,71 @@ public:
      * Raises an error if this ibitstream has not been properly opened.
      */
     
+    /* Member function ibitstream::peekBits
+     * ------------------------------------
+     * The first bulk call switches the stream to buffered reading: the
+     * remaining bits of a byte that readBit had started are carried over,
+     * and from then on the stream is read ahead in large blocks.
+     */
+    uint64_t peekBits(int n) {
+        if (!buffering) {
+            startBuffering();
+        }
+        return reader.peekBits(n);
+    }
+    /**
+     * Returns the next n bits (1 to 56) without consuming them, the first
+     * one in the least significant position, so the bit order matches
+     * repeated calls to readBit.  Bits past the end of the stream read as 0.
+     * Once any of the bulk functions has been used, only the bit functions
+     * may be used to read from the stream.
+     */
+
+    void consume(int n) {
+        if (!buffering) {
+            startBuffering();
+        }
+        reader.consume(n);
+    }
+    /**
+     * Discards the next n bits.
+     */
+
+    uint64_t readBits(int n) {
+        if (!buffering) {
+            startBuffering();
+        }
+        return reader.readBits(n);
+    }
+    /**
+     * Reads and consumes the next n bits (1 to 56).
+     */
+
+    /* Member function ibitstream::hasBits
+     * -----------------------------------
+     * Also switches to buffered reading.
+     */
+    bool hasBits() {
+        if (!buffering) {
+            startBuffering();
+        }
+        return reader.available() > 0;
+    }
+    /**
+     * Returns whether any bits remain to be read.
+     */
+
+    int available() {
+        if (!buffering) {
+            startBuffering();
+        }
+        return reader.available();
+    }
+    /**
+     * Returns how many bits can be peeked before the data runs out, up to
+     * 56; more may remain.
+     */
+    
     /* Member function ibitstream::rewind
      * ----------------------------------
      * Simply seeks back to beginning of file, so reading begins again
@@ -142,6 +577,9 @@ public:
         }
         clear();
         seekg(0, std::ios::beg);
+        reader.clear();
+        buffering = false;
+        pos = NUM_BITS_IN_BYTE;
     }
     /**
      * Rewinds the ibitstream back to the beginning so that subsequent reads
@@ -195,10 +633,24 @@ public:
      */
     
 private:
+    /* Member function ibitstream::startBuffering
+     * ------------------------------------------
+     * Hands a byte that readBit has partly consumed to the reader.
+     */
+    void startBuffering() {
+        buffering = true;
+        if (pos != NUM_BITS_IN_BYTE && lastTell == tellg()) {
+            reader.seed(curByte >> pos, NUM_BITS_IN_BYTE - pos);
+        }
+        pos = NUM_BITS_IN_BYTE;
+    }
+
     std::streampos lastTell;
     int curByte;
     int pos;
     bool fake;
+    bitreader reader;
+    bool buffering;
 };
 
 
@@ -221,8 +673,13 @@ public:
      * "pos" is the bit position within curByte that is next to write
      * We set initial state for lastTell and curByte to 0, then pos is
      * set at 8 so that next writeBit will start a new byte.
+     * "writer" holds the bits written through writeBits until flushBits.
+     * "flushOut" is what the stream is tied to while writer holds bits (see
+     * writeBits).
      */
-    obitstream() : std::ostream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE) {
+    obitstream() : std::ostream(NULL), lastTell(0), curByte(0), pos(NUM_BITS_IN_BYTE),
+                   writer(this), buffering(false), flusher(this), flushOut(&flusher),
+                   savedTie(NULL) {
         this->fake = false;
     }
     /**
@@ -251,6 +708,9 @@ public:
         
         if (this->fake) {
             put(bit == 1 ? '1' : '0');
+        } else if (buffering) {
+            // keep the bit in order with the ones still in the buffer
+            writer.writeBits(bit, 1);
         } else {
             // if just filled curByte or if data written to stream after last writeBit()
             if (lastTell != tellp() || pos == NUM_BITS_IN_BYTE) {
@@ -278,6 +738,67 @@ public:
      * Writes a single bit to the obitstream.
      * Raises an error if this obitstream has not been properly opened.
      */
+
+    /* Member function obitstream::writeBits
+     * -------------------------------------
+     * Bits go into the 64-bit accumulator of "writer" and reach the stream in
+     * large blocks, instead of one seekp/put per bit as in writeBit.  When
+     * buffering starts right after writeBit left a partial byte, we back up
+     * over that byte and continue it, so the two can be mixed freely.
+     * While bits are buffered the stream is tied to flushOut: every <<, put
+     * or write first flushes the tied stream, which hands the bits over, so
+     * bytes written that way always land after them.
+     */
+    void writeBits(uint64_t value, int nbits) {
+        if (this->fake) {
+            for (int i = 0; i < nbits; i++) {
+                put(((value >> i) & 1) ? '1' : '0');
+            }
+            return;
+        }
+        if (!buffering) {
+            if (pos != NUM_BITS_IN_BYTE && lastTell == tellp()) {
+                seekp(-1, std::ios::cur);
+                writer.seed(curByte, pos);
+            }
+            pos = NUM_BITS_IN_BYTE;
+            buffering = true;
+            savedTie = tie(&flushOut);
+        }
+        writer.writeBits(value, nbits);
+    }
+    /**
+     * Writes the low nbits bits of value (at most 57), least significant bit
+     * first, which is the order nbits calls to writeBit would produce.  Bits
+     * and bytes written with << or put may be mixed freely.
+     */
+
+    /* Member function obitstream::flushBits
+     * -------------------------------------
+     * Hands all buffered whole bytes to the stream.  A trailing partial byte
+     * is written the same way writeBit leaves one, so a later writeBit or
+     * writeBits continues filling it.
+     */
+    void flushBits() {
+        if (!buffering) {
+            return;
+        }
+        buffering = false;
+        tie(savedTie);  // before put below, which would come back here
+        writer.flush();
+        if (writer.pendingCount() > 0) {
+            curByte = writer.pendingBits();
+            pos = writer.pendingCount();
+            writer.clearPending();
+            put(curByte);
+            lastTell = tellp();
+        }
+    }
+    /**
+     * Writes any bits buffered by writeBits to the stream.  This is done
+     * automatically before anything else is written to the stream, and by
+     * size() and by close() on an ofbitstream.
+     */
     
     
     /* Member function obitstream::size
@@ -290,6 +811,7 @@ public:
         //if (!is_open()) {
             //error("obitstream::size: stream is not open");
         //}
+        flushBits();
         clear();                    // clear any error state
         streampos cur = tellp();    // save current streampos
         seekp(0, std::ios::end);            // seek to end
@@ -317,10 +839,33 @@ public:
      */
     
 private:
+    /*
+     * The buffer of flushOut: flushing it flushes the bits of its owner.
+     */
+    class bitflusher : public std::streambuf {
+    public:
+        explicit bitflusher(obitstream* owner) : owner(owner) {}
+    protected:
+        int sync() {
+            owner->flushBits();
+            return 0;
+        }
+    private:
+        obitstream* owner;
+    };
+
+    obitstream(const obitstream&);
+    obitstream& operator=(const obitstream&);
+
     std::streampos lastTell;
     int curByte;
     int pos;
     bool fake;
+    bitwriter writer;
+    bool buffering;
+    bitflusher flusher;
+    std::ostream flushOut;
+    std::ostream* savedTie;    // what the stream was tied to before writeBits
 };
 
 /**
@@ -505,6 +1050,16 @@ public:
         open(filename.c_str());
     }
 
+    /* Destructor ofbitstream::~ofbitstream
+     * ------------------------------------
+     * Bits buffered by writeBits must reach the file before fb goes away.
+     */
+    ~ofbitstream() {
+        if (fb.is_open()) {
+            flushBits();
+        }
+    }
+
     
     /* Member function ofbitstream::is_open
      * ------------------------------------
@@ -520,9 +1075,11 @@ public:
     
     /* Member function ofbitstream::close
      * ----------------------------------
-     * Closes the given file.
+     * Closes the given file, after writing out any bits still buffered
+     * by writeBits.
      */
     void close() {
+        flushBits();
         if (!fb.close()) {
             setstate(std::ios::failbit);
         }
@@ -603,6 +1160,7 @@ public:
      * Retrives the underlying string data.
      */
     std::string str() {
+        flushBits();
         return sb.str();
     }
     /**
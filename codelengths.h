@@ -0,0 +1,194 @@
+//
+// codelengths.h
+// Computes Huffman code lengths straight from symbol counts, without
+// building a tree.  The symbols are sorted by count, and the in-place
+// algorithm of Moffat and Katajainen ("In-Place Calculation of
+// Minimum-Redundancy Codes", 1995) turns the sorted weights into code
+// lengths in three linear passes over the same array: the first merges
+// weights as the two-queue Huffman construction does and leaves parent
+// indices behind, the second turns those into internal node depths, and
+// the third into leaf depths.  Everything lives in fixed arrays on the
+// stack.  The codes themselves are then assigned canonically from the
+// lengths.
+//
+// Optionally the lengths can be limited to a maximum.  If the Huffman
+// lengths exceed it, the package-merge algorithm of Larmore and Hirschberg
+// finds the best code within the limit instead.  Short codes keep decode
+// tables small and let the encoder always use its multi-symbol kernels
+// (KERNEL_MAX_CODE_LENGTH), at a usually tiny cost in compression.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "bitstream.h"
+#include "encodekernel.h"
+
+using namespace std;
+
+//
+// Replaces the n weights in A, sorted in ascending order, with the code
+// lengths of an optimal prefix code for them.  The lengths come out in
+// descending order.
+//
+inline void _minimumRedundancy(uint64_t A[], int n) {
+    if (n == 0)
+        return;
+    if (n == 1) {  // a lone symbol needs no bits
+        A[0] = 0;
+        return;
+    }
+    // first pass, left to right: merge, leaving parent pointers
+    A[0] += A[1];
+    int root = 0;
+    int leaf = 2;
+    for (int next = 1; next < n - 1; next++) {
+        // first item of the pair: a leaf or an internal node
+        if (leaf >= n || A[root] < A[leaf]) {
+            A[next] = A[root];
+            A[root++] = next;
+        } else {
+            A[next] = A[leaf++];
+        }
+        // second item
+        if (leaf >= n || (root < next && A[root] < A[leaf])) {
+            A[next] += A[root];
+            A[root++] = next;
+        } else {
+            A[next] += A[leaf++];
+        }
+    }
+    // second pass, right to left: internal node depths
+    A[n - 2] = 0;
+    for (int next = n - 3; next >= 0; next--) {
+        A[next] = A[A[next]] + 1;
+    }
+    // third pass, right to left: leaf depths
+    int avail = 1;
+    int used = 0;
+    uint64_t depth = 0;
+    root = n - 2;
+    int next = n - 1;
+    while (avail > 0) {
+        while (root >= 0 && A[root] == depth) {
+            used++;
+            root--;
+        }
+        while (avail > used) {
+            A[next--] = depth;
+            avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+//
+// Package-merge: sets lengths[i] to the length of the i-th of the n
+// weights w, sorted in ascending order, in the optimal code whose lengths
+// are at most maxLength.  Needs n <= 2^maxLength.
+//
+// The list of level maxLength holds the leaves; each level above merges
+// the leaves with packages of adjacent pairs from the level below.  The
+// first 2n - 2 items of the top level are the solution.  Picking the first
+// k items of a level picks its leading leaves, each of which gains a bit,
+// and its leading packages, which pick the first two items per package of
+// the level below.  So only whether each item is a package is kept.
+//
+inline void _packageMerge(const uint64_t w[], int n, int maxLength, int lengths[]) {
+    vector<vector<bool>> isPackage(maxLength);
+    vector<uint64_t> below(w, w + n);  // the weights of the level below
+    vector<uint64_t> level;
+    isPackage[maxLength - 1].assign(n, false);
+    for (int j = maxLength - 2; j >= 0; j--) {
+        level.clear();
+        size_t leaf = 0, package = 0;
+        size_t nPackages = below.size() / 2;
+        while (leaf < (size_t)n || package < nPackages) {
+            uint64_t packed = package < nPackages
+                            ? below[2 * package] + below[2 * package + 1] : 0;
+            if (package >= nPackages || (leaf < (size_t)n && w[leaf] <= packed)) {
+                level.push_back(w[leaf++]);
+                isPackage[j].push_back(false);
+            } else {
+                level.push_back(packed);
+                package++;
+                isPackage[j].push_back(true);
+            }
+        }
+        below.swap(level);
+    }
+    for (int i = 0; i < n; i++) {
+        lengths[i] = 0;
+    }
+    size_t picked = 2 * (size_t)n - 2;
+    for (int j = 0; j < maxLength && picked > 0; j++) {
+        size_t leaves = 0, packages = 0;
+        for (size_t k = 0; k < picked; k++) {
+            if (isPackage[j][k])
+                packages++;
+            else
+                lengths[leaves++]++;
+        }
+        picked = 2 * packages;
+    }
+}
+
+//
+// Returns the longest code length buildCodeLengths allows n symbols when
+// asked for maxLength: maxLength itself, unless n symbols do not fit in
+// codes that short.
+//
+inline int codeLengthLimit(int maxLength, int n) {
+    while ((1 << maxLength) < n) {
+        maxLength++;
+    }
+    return maxLength;
+}
+
+//
+// Sets the length of codes[i] to the Huffman code length of symbol i, for
+// every symbol from 0 to PSEUDO_EOF, given how often each occurs.  Symbols
+// that do not occur get length 0, and so does a symbol that occurs alone.
+// Equal counts are ordered by symbol, so the result depends only on the
+// counts.  If maxLength is not 0, no length exceeds it (or the least
+// length that fits every symbol, if that is more).  The bits of the codes
+// are cleared.
+//
+inline void buildCodeLengths(const uint64_t counts[PSEUDO_EOF + 1],
+                             HuffmanCode codes[PSEUDO_EOF + 1],
+                             int maxLength = 0) {
+    // (count, symbol) pairs, sorted by count
+    pair<uint64_t, int> sorted[PSEUDO_EOF + 1];
+    uint64_t A[PSEUDO_EOF + 1];
+    int n = 0;
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        codes[i].bits = 0;
+        codes[i].length = 0;
+        if (counts[i] != 0)
+            sorted[n++] = make_pair(counts[i], i);
+    }
+    sort(sorted, sorted + n);
+    for (int i = 0; i < n; i++) {
+        A[i] = sorted[i].first;
+    }
+    _minimumRedundancy(A, n);
+    // A[0] is the longest
+    if (maxLength > 0 && n > 1 && A[0] > (uint64_t)maxLength) {
+        maxLength = codeLengthLimit(maxLength, n);
+        uint64_t weights[PSEUDO_EOF + 1];
+        int lengths[PSEUDO_EOF + 1];
+        for (int i = 0; i < n; i++) {
+            weights[i] = sorted[i].first;
+        }
+        _packageMerge(weights, n, maxLength, lengths);
+        for (int i = 0; i < n; i++) {
+            A[i] = (uint64_t)lengths[i];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        codes[sorted[i].second].length = (int)A[i];
+    }
+}
@@ -0,0 +1,120 @@
+//
+// compressor.h
+// A compressor that is fed its input piece by piece, for data that cannot
+// be mapped or read twice, such as a pipe.  It writes the same block
+// format as compress (container.h): input is collected until a block is
+// full, and the block is then coded with its own table and written out
+// right away.  So memory holds one block and its coded form however long
+// the input is, and the only thing kept for the end is the block index,
+// a few bytes per block.
+//
+#pragma once
+
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "util.h"
+
+using namespace std;
+
+class Compressor {
+public:
+    //
+    // constructor:
+    //
+    // Starts a compressed stream on out, coded as options say.  Blocks are
+    // coded on the calling thread; options.threads is not used.  The stream
+    // is only complete once finish has been called.
+    //
+    explicit Compressor(ostream &out, const CompressOptions &options = CompressOptions())
+        : out(out), options(options), offset(0), finished(false) {
+        ContainerHeader header = {};
+        header.version = CONTAINER_VERSION;
+        header.flags = options.interleaved ? INTERLEAVED_FLAG : 0;
+        header.blockSize = min(max(options.blockSize, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+        blockSize = (size_t)header.blockSize;
+        ostringstream head;
+        writeHeader(head, header);
+        emit(head.str().data(), head.str().length());
+        pending.reserve(blockSize);
+    }
+
+    //
+    // write:
+    //
+    // Adds the length bytes at data to the input.  Every block this fills is
+    // coded and written before returning.  Returns false once writing to
+    // the output has failed.
+    //
+    bool write(const char* data, size_t length) {
+        while (length > 0) {
+            if (pending.empty() && length >= blockSize) {
+                // a whole block in the caller's buffer needs no copy
+                codeBlock(data, blockSize);
+                data += blockSize;
+                length -= blockSize;
+                continue;
+            }
+            size_t n = min(length, blockSize - pending.length());
+            pending.append(data, n);
+            data += n;
+            length -= n;
+            if (pending.length() == blockSize) {
+                codeBlock(pending.data(), pending.length());
+                pending.clear();
+            }
+        }
+        return !out.fail();
+    }
+
+    //
+    // finish:
+    //
+    // Codes the last, partly filled block and ends the stream with the
+    // block index.  Nothing may be written after this.  Returns false if
+    // writing to the output failed at any point.
+    //
+    bool finish() {
+        if (!finished) {
+            if (!pending.empty())
+                codeBlock(pending.data(), pending.length());
+            pending.clear();
+            ostringstream tail;
+            writeBlockIndex(tail, blocks, offset);
+            emit(tail.str().data(), tail.str().length());
+            out.flush();
+            finished = true;
+        }
+        return !out.fail();
+    }
+
+private:
+    Compressor(const Compressor&);
+    Compressor& operator=(const Compressor&);
+
+    void codeBlock(const char* data, size_t length) {
+        _encodeBlock(data, length, options.maxCodeLength, options.interleaved,
+                     bits, block, false, unused);
+        BlockEntry entry = {offset, block.length(), length};
+        blocks.push_back(entry);
+        emit(block.data(), block.length());
+    }
+
+    void emit(const char* data, size_t length) {
+        out.write(data, length);
+        offset += length;
+    }
+
+    ostream &out;
+    CompressOptions options;
+    size_t blockSize;
+    string pending;     // input of the block being filled
+    bitwriter bits;     // reused by every block
+    string block;
+    string unused;
+    vector<BlockEntry> blocks;
+    uint64_t offset;    // where the next byte goes in the output
+    bool finished;
+};
@@ -0,0 +1,298 @@
+//
+// container.h
+// The layout of compressed files.  They start with a binary, versioned
+// header:
+//
+//   magic          4 bytes, 0x89 'H' 'U' 'F'
+//   version        1 byte
+//   flags          1 byte, 0 in version 1; see INTERLEAVED_FLAG
+//
+// In version 1 one code covers the whole file, which follows the header
+// as a single run of bits ending in PSEUDO_EOF.  The header goes on with:
+//
+//   original size  varint, the number of bytes that were compressed
+//   code lengths   one entry per symbol from 0 to PSEUDO_EOF
+//
+// Version 2 splits the input into blocks that are coded independently,
+// each with a code of its own, so blocks can be coded in any order or in
+// parallel and a reader can start at any of them.  The header goes on with
+// the block size, and the rest of the file is:
+//
+//   blocks         each: original size (varint, not 0), coded size
+//                  (varint), code lengths, then the coded bits padded to a
+//                  byte; a block knows its size, so it has no PSEUDO_EOF
+//   end marker     varint 0, where the next block size would be
+//   block index    varint block count, then per block its stored size (all
+//                  of the above, in bytes) and its original size, varints
+//   trailer        8 bytes, little-endian offset of the end marker, then
+//                  the 4 magic bytes again
+//
+// With INTERLEAVED_FLAG set, every block is coded as INTERLEAVED_STREAMS
+// streams over consecutive parts of it, which a decoder can advance side
+// by side.  The coded size then covers a jump table, the varint sizes of
+// all streams but the last, and the streams, each padded to a byte.
+//
+// A reader that has the whole file finds the index through the trailer;
+// one that reads the blocks in order can stop at the end marker.
+//
+// Varints are little-endian base 128: seven bits per byte, high bit set on
+// every byte but the last.  In the code-length table a byte below 0x80 is
+// one length and 0x80 + n stands for n + 1 symbols without a code, so for
+// typical text a table is a few dozen bytes.  The codes are the canonical
+// codes for those lengths.
+//
+// The first byte tells the formats apart: the magic starts with 0x89 and
+// the text frequency-map header of the oldest files with '{'.
+//
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <string.h>
+#include "bitstream.h"
+#include "mappedfile.h"
+#include "encodekernel.h"
+#include "decodetable.h"
+
+using namespace std;
+
+const unsigned char CONTAINER_MAGIC[4] = {0x89, 'H', 'U', 'F'};
+// The newest version, the one this code writes by default.
+const int CONTAINER_VERSION = 2;
+// The version with one code for the whole file.
+const int SINGLE_CODE_VERSION = 1;
+
+// Version 2 flags: every block is split into interleaved streams.
+const int INTERLEAVED_FLAG = 1;
+const int INTERLEAVED_STREAMS = 4;
+
+// Block sizes a version 2 file may use.
+const uint64_t MIN_BLOCK_SIZE = 1 << 12;
+const uint64_t MAX_BLOCK_SIZE = 1 << 26;
+// The size of the trailer of a version 2 file.
+const size_t TRAILER_SIZE = 8 + sizeof(CONTAINER_MAGIC);
+
+struct ContainerHeader {
+    int version;
+    int flags;
+    // version 1: the original size and the code; version 2 stores neither
+    // in the header, and the original size is added up from the index
+    uint64_t originalSize;
+    // only the lengths are stored; the bits are assigned canonically
+    HuffmanCode codes[PSEUDO_EOF + 1];
+    // version 2: the most bytes a block holds
+    uint64_t blockSize;
+};
+
+// One entry of the block index of a version 2 file.
+struct BlockEntry {
+    uint64_t offset;       // where the block starts in the file
+    uint64_t storedSize;   // bytes it takes in the file
+    uint64_t rawSize;      // bytes it decodes to
+};
+
+//
+// Writes value as a varint.
+//
+inline void writeVarint(ostream &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.put((char)(0x80 | (value & 0x7F)));
+        value >>= 7;
+    }
+    out.put((char)value);
+}
+
+//
+// Reads a varint into value.  Returns false if the input ends first or the
+// value does not fit in 64 bits.
+//
+inline bool readVarint(istream &in, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == EOF)
+            return false;
+        value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return shift < 63 || c <= 1;
+    }
+    return false;
+}
+
+//
+// Writes the code length of every symbol from 0 to PSEUDO_EOF, with runs
+// of unused symbols collapsed.
+//
+inline void writeCodeLengths(ostream &out, const HuffmanCode codes[PSEUDO_EOF + 1]) {
+    int i = 0;
+    while (i <= PSEUDO_EOF) {
+        if (codes[i].length != 0) {
+            out.put((char)codes[i].length);
+            i++;
+            continue;
+        }
+        int run = 0;
+        while (i + run <= PSEUDO_EOF && run < 128 && codes[i + run].length == 0) {
+            run++;
+        }
+        out.put((char)(0x80 + run - 1));
+        i += run;
+    }
+}
+
+//
+// Reads a table written by writeCodeLengths into the lengths of codes.
+// Returns false if it is cut off or its lengths do not form a prefix code
+// the decoder can handle.
+//
+inline bool readCodeLengths(istream &in, HuffmanCode codes[PSEUDO_EOF + 1]) {
+    int i = 0;
+    while (i <= PSEUDO_EOF) {
+        int c = in.get();
+        if (c == EOF)
+            return false;
+        int run = (c & 0x80) ? (c & 0x7F) + 1 : 1;
+        if (i + run > PSEUDO_EOF + 1)
+            return false;
+        for (int k = 0; k < run; k++, i++) {
+            codes[i].bits = 0;
+            codes[i].length = (c & 0x80) ? 0 : c;
+        }
+    }
+    // Kraft inequality: the codes must not overlap
+    uint64_t space = 0;
+    for (i = 0; i <= PSEUDO_EOF; i++) {
+        if (codes[i].length > decodetable::MAX_CODE_LENGTH)
+            return false;
+        if (codes[i].length)
+            space += 1ULL << (decodetable::MAX_CODE_LENGTH - codes[i].length);
+    }
+    return space <= 1ULL << decodetable::MAX_CODE_LENGTH;
+}
+
+//
+// Writes header in the format of its version, which must be
+// SINGLE_CODE_VERSION or CONTAINER_VERSION.
+//
+inline void writeHeader(ostream &out, const ContainerHeader &header) {
+    out.write((const char*)CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    out.put((char)header.version);
+    out.put((char)header.flags);
+    if (header.version == SINGLE_CODE_VERSION) {
+        writeVarint(out, header.originalSize);
+        writeCodeLengths(out, header.codes);
+    } else {
+        writeVarint(out, header.blockSize);
+    }
+}
+
+//
+// Reads a header in either format.  Returns false for anything else,
+// including versions and flags newer than this reader.  The text header
+// of the oldest files is read by readFrequencyHeader instead.
+//
+inline bool readHeader(istream &in, ContainerHeader &header) {
+    header.version = 0;
+    header.flags = 0;
+    header.originalSize = 0;
+    header.blockSize = 0;
+    for (size_t i = 0; i < sizeof(CONTAINER_MAGIC); i++) {
+        if (in.get() != CONTAINER_MAGIC[i])
+            return false;
+    }
+    header.version = in.get();
+    header.flags = in.get();
+    if (header.version < 1 || header.version > CONTAINER_VERSION || header.flags < 0)
+        return false;
+    if (header.version == SINGLE_CODE_VERSION)
+        return header.flags == 0 && readVarint(in, header.originalSize)
+            && readCodeLengths(in, header.codes);
+    if (header.flags & ~INTERLEAVED_FLAG)
+        return false;
+    return readVarint(in, header.blockSize)
+        && header.blockSize >= MIN_BLOCK_SIZE && header.blockSize <= MAX_BLOCK_SIZE;
+}
+
+//
+// Writes what follows the last block of a version 2 file: the end marker,
+// which starts at offset, the index of blocks and the trailer.
+//
+inline void writeBlockIndex(ostream &out, const vector<BlockEntry> &blocks,
+                            uint64_t offset) {
+    writeVarint(out, 0);
+    writeVarint(out, blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+        writeVarint(out, blocks[i].storedSize);
+        writeVarint(out, blocks[i].rawSize);
+    }
+    unsigned char trailer[TRAILER_SIZE];
+    StoreLE64(trailer, offset);
+    memcpy(trailer + 8, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    out.write((const char*)trailer, sizeof(trailer));
+}
+
+//
+// Reads the block index of the version 2 file in the size bytes at data,
+// whose first block starts at firstBlock, into blocks.  Returns false if
+// the trailer or the index is damaged or the blocks it lists do not tile
+// the file from firstBlock to the end marker.
+//
+inline bool readBlockIndex(const unsigned char* data, size_t size,
+                           uint64_t firstBlock, vector<BlockEntry> &blocks) {
+    blocks.clear();
+    if (size < firstBlock + TRAILER_SIZE)
+        return false;
+    const unsigned char* trailer = data + size - TRAILER_SIZE;
+    if (memcmp(trailer + 8, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0)
+        return false;
+    uint64_t end = LoadLE64(trailer);
+    if (end < firstBlock || end >= size - TRAILER_SIZE)
+        return false;
+    spanbuf buf(data + end, size - TRAILER_SIZE - end);
+    istream in(&buf);
+    uint64_t marker, count;
+    if (!readVarint(in, marker) || marker != 0 || !readVarint(in, count))
+        return false;
+    uint64_t offset = firstBlock;
+    for (uint64_t i = 0; i < count; i++) {
+        BlockEntry entry;
+        if (!readVarint(in, entry.storedSize) || !readVarint(in, entry.rawSize))
+            return false;
+        if (entry.rawSize == 0 || entry.storedSize > end - offset)
+            return false;
+        entry.offset = offset;
+        offset += entry.storedSize;
+        blocks.push_back(entry);
+    }
+    return offset == end;
+}
+
+//
+// Reads the text header of the oldest files, e.g. "{97:3, 256:1}", into
+// (character, count) pairs.  Those files were coded with the tree the
+// counts build, and ties in that tree went by the order the header lists
+// them, so the pairs are kept in that order rather than put in a map.
+// Returns false if the header is malformed.
+//
+inline bool readFrequencyHeader(istream &in, vector<pair<int, int>> &counts) {
+    if (in.get() != '{')
+        return false;
+    if (in.peek() == '}') {
+        in.get();
+        return true;
+    }
+    while (true) {
+        int key, value;
+        if (!(in >> key) || in.get() != ':' || !(in >> value))
+            return false;
+        counts.push_back(make_pair(key, value));
+        int c = in.get();
+        if (c == '}')
+            return true;
+        if (c != ',' || in.get() != ' ')
+            return false;
+    }
+}
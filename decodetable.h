@@ -0,0 +1,331 @@
+//
+// decodetable.h
+// A lookup-table Huffman decoder.  Instead of following one tree pointer
+// per bit, the decoder peeks the next ROOT_BITS bits and indexes a table
+// whose entry holds the symbol those bits start with and the length of its
+// code.  Codes longer than ROOT_BITS get a second-level table, reached
+// through their ROOT_BITS-bit prefix, so the root table stays small enough
+// to live in L1.  The few codes that are longer than both levels together
+// belong to very rare symbols and are matched one by one.  The table is
+// built from a code for every symbol, however those codes were assigned.
+//
+// For bulk decoding there is also a multi-symbol table over the same
+// ROOT_BITS bits.  With the 3-6 bit codes typical of text, one window
+// usually holds two or three whole codes, so each entry stores up to three
+// decoded bytes and the bits they use, and one lookup emits all of them.
+// Data coded as several independent streams can also be decoded with all
+// streams advancing in the same loop.
+//
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "encodekernel.h"
+
+using namespace std;
+
+class decodetable {
+public:
+    // Bits resolved by the first lookup.  The root and multi-symbol tables
+    // have 2^11 four-byte entries each, 16 KiB together, which keeps both
+    // in L1.  On a 45 MB log 12 bits measured as fast, 10 bits 5% slower.
+    static const int ROOT_BITS = 11;
+    // Most bytes one multi-symbol entry holds.
+    static const int MULTI_SYMBOLS = 3;
+    // Most bits resolved by a second-level table.
+    static const int SUB_BITS = 7;
+    // Longest code the tables handle: one peekBits call must cover it.
+    static const int MAX_CODE_LENGTH = 56;
+
+    //
+    // default constructor:
+    //
+    // Creates an empty table that decodes nothing.
+    //
+    decodetable() : rootBits(0), maxLength(0) {}
+
+    //
+    // build:
+    //
+    // Builds the tables for the count codes in codes, where codes[i] is the
+    // code of symbol i and a length of 0 means i does not occur.  Returns
+    // false if some code is longer than MAX_CODE_LENGTH.
+    //
+    bool build(const HuffmanCode codes[], int count) {
+        maxLength = 0;
+        for (int i = 0; i < count; i++) {
+            if (codes[i].length > maxLength)
+                maxLength = codes[i].length;
+        }
+        entries.clear();
+        multi.clear();
+        longCodes.clear();
+        if (maxLength > MAX_CODE_LENGTH)
+            return false;
+        rootBits = maxLength < ROOT_BITS ? maxLength : ROOT_BITS;
+        entries.assign((size_t)1 << rootBits, Entry());
+        uint32_t rootMask = (1u << rootBits) - 1;
+        // short codes fill every root slot that starts with them
+        for (int i = 0; i < count; i++) {
+            int len = codes[i].length;
+            if (len == 0 || len > rootBits)
+                continue;
+            for (uint32_t k = 0; k < (1u << (rootBits - len)); k++) {
+                Entry &e = entries[(uint32_t)codes[i].bits | (k << len)];
+                e.symbol = (uint16_t)i;
+                e.length = (uint8_t)len;
+            }
+        }
+        // long codes: size each second-level table for its longest code
+        for (int i = 0; i < count; i++) {
+            if (codes[i].length > rootBits) {
+                Entry &root = entries[(uint32_t)codes[i].bits & rootMask];
+                int extra = codes[i].length - rootBits;
+                if (extra > SUB_BITS)
+                    extra = SUB_BITS;
+                if (extra > root.subBits)
+                    root.subBits = (uint8_t)extra;
+            }
+        }
+        for (uint32_t prefix = 0; prefix <= rootMask; prefix++) {
+            if (entries[prefix].subBits > 0) {
+                entries[prefix].symbol = (uint16_t)entries.size();
+                entries.resize(entries.size() + ((size_t)1 << entries[prefix].subBits));
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            int len = codes[i].length;
+            if (len <= rootBits)
+                continue;
+            const Entry &root = entries[(uint32_t)codes[i].bits & rootMask];
+            size_t base = root.symbol;
+            int subBits = root.subBits;
+            int extra = len - rootBits;
+            uint64_t suffix = codes[i].bits >> rootBits;
+            if (extra > subBits) {
+                // too long for both levels: leave a pointer to the slow path
+                entries[base + (size_t)(suffix & ((1u << subBits) - 1))].symbol = ESCAPE;
+                LongCode lc = {codes[i].bits, len, i};
+                longCodes.push_back(lc);
+                continue;
+            }
+            for (uint64_t k = 0; k < (1ULL << (subBits - extra)); k++) {
+                Entry &e = entries[base + (size_t)(suffix | (k << extra))];
+                e.symbol = (uint16_t)i;
+                e.length = (uint8_t)len;
+            }
+        }
+        buildMulti();
+        return true;
+    }
+
+    //
+    // decodeSymbol:
+    //
+    // Decodes and consumes one symbol from in.  Returns -1 if the bits do
+    // not start any code, which only happens on corrupt input.
+    //
+    template <typename BitInput>
+    int decodeSymbol(BitInput &in) const {
+        uint64_t bits = in.peekBits(maxLength);
+        const Entry* e = &entries[(size_t)(bits & ((1u << rootBits) - 1))];
+        if (e->subBits) {
+            uint64_t sub = (bits >> rootBits) & ((1ULL << e->subBits) - 1);
+            e = &entries[e->symbol + (size_t)sub];
+        }
+        if (e->length == 0)
+            return e->symbol == ESCAPE ? decodeLong(in, bits) : -1;
+        in.consume(e->length);
+        return e->symbol;
+    }
+
+    //
+    // decodeBytes:
+    //
+    // Decodes byte symbols from in into out until capacity bytes have been
+    // written, the input runs out, or a symbol that is not a byte (such as
+    // PSEUDO_EOF) or corrupt input is found; ended is set in the latter two
+    // cases and the symbol that ended it, or -1, is stored in last.
+    // Returns the number of bytes written.
+    //
+    template <typename BitInput>
+    size_t decodeBytes(BitInput &in, unsigned char* out, size_t capacity,
+                       bool &ended, int &last) const {
+        size_t n = 0;
+        ended = false;
+        // fast loop: one available() check covers four multi lookups
+        while (n + 4 * MULTI_SYMBOLS <= capacity && in.available() >= 4 * rootBits) {
+            int k = 0;
+            for (; k < 4; k++) {
+                uint32_t m = multi[(size_t)in.peekBits(rootBits)];
+                if (m == 0)
+                    break;
+                out[n] = (unsigned char)m;
+                out[n + 1] = (unsigned char)(m >> 8);
+                out[n + 2] = (unsigned char)(m >> 16);
+                n += m >> 28;
+                in.consume((m >> 24) & 0xF);
+            }
+            if (k == 4)
+                continue;
+            int symbol = decodeSymbol(in);
+            if (symbol < 0 || symbol > 255) {
+                ended = true;
+                last = symbol;
+                return n;
+            }
+            out[n++] = (unsigned char)symbol;
+        }
+        // tail: near the end of the output or the input, check every step
+        while (n < capacity && in.hasBits()) {
+            uint32_t m = multi[(size_t)in.peekBits(rootBits)];
+            if (m != 0 && n + MULTI_SYMBOLS <= capacity) {
+                out[n] = (unsigned char)m;
+                out[n + 1] = (unsigned char)(m >> 8);
+                out[n + 2] = (unsigned char)(m >> 16);
+                n += m >> 28;
+                in.consume((m >> 24) & 0xF);
+                continue;
+            }
+            int symbol = decodeSymbol(in);
+            if (symbol < 0 || symbol > 255) {
+                ended = true;
+                last = symbol;
+                break;
+            }
+            out[n++] = (unsigned char)symbol;
+        }
+        return n;
+    }
+
+    //
+    // decodeStreams:
+    //
+    // Decodes N streams side by side: stream k holds count[k] byte symbols,
+    // which go to out[k].  Every step does one lookup in each stream, and
+    // since the streams share no bit position the CPU can overlap their
+    // lookups instead of waiting on one chain of code lengths.  Returns
+    // false if a stream runs out or holds a symbol that is not a byte.
+    //
+    template <int N, typename BitInput>
+    bool decodeStreams(BitInput in[N], unsigned char* const out[N],
+                       const size_t count[N]) const {
+        size_t n[N] = {};
+        // local copies, so the byte stores below cannot alias their state
+        BitInput r[N];
+        for (int k = 0; k < N; k++) {
+            r[k] = in[k];
+        }
+        while (true) {
+            // steps every stream has room for, at up to three bytes a step
+            size_t steps = (count[0] - n[0]) / MULTI_SYMBOLS;
+            for (int k = 1; k < N; k++) {
+                size_t room = (count[k] - n[k]) / MULTI_SYMBOLS;
+                if (room < steps)
+                    steps = room;
+            }
+            if (steps == 0)
+                break;
+            for (size_t step = 0; step < steps; step++) {
+                for (int k = 0; k < N; k++) {
+                    uint32_t m = multi[(size_t)r[k].peekBits(rootBits)];
+                    if (m != 0) {
+                        out[k][n[k]] = (unsigned char)m;
+                        out[k][n[k] + 1] = (unsigned char)(m >> 8);
+                        out[k][n[k] + 2] = (unsigned char)(m >> 16);
+                        n[k] += m >> 28;
+                        r[k].consume((m >> 24) & 0xF);
+                        continue;
+                    }
+                    int symbol = decodeSymbol(r[k]);
+                    if (symbol < 0 || symbol > 255)
+                        return false;
+                    out[k][n[k]++] = (unsigned char)symbol;
+                }
+            }
+        }
+        // tails: the last few bytes of each stream, one stream at a time
+        for (int k = 0; k < N; k++) {
+            bool ended;
+            int last;
+            size_t rest = count[k] - n[k];
+            if (decodeBytes(r[k], out[k] + n[k], rest, ended, last) != rest)
+                return false;
+        }
+        return true;
+    }
+
+    //
+    // Returns the longest code length, 0 if no symbol has a code of its own
+    // (a tree that is a single leaf).
+    //
+    int longestCode() const { return maxLength; }
+
+private:
+    // symbol is the decoded symbol, or for a root entry with subBits > 0
+    // the index of its second-level table.  length 0 marks no code, unless
+    // symbol is ESCAPE, which sends the lookup to longCodes.
+    struct Entry {
+        uint16_t symbol;
+        uint8_t length;
+        uint8_t subBits;
+        Entry() : symbol(0), length(0), subBits(0) {}
+    };
+
+    struct LongCode {
+        uint64_t bits;
+        int length;
+        int symbol;
+    };
+
+    static const uint16_t ESCAPE = 0xFFFF;
+
+    //
+    // Fills the multi-symbol table.  Entry bits 0-23 hold up to three
+    // bytes, bits 24-27 the number of bits they use and bits 28-29 how many
+    // there are; 0 means the window does not start with a whole byte code.
+    // Decoding the window greedily through the root table is safe because
+    // a code no longer than the bits still known is replicated over every
+    // value of the unknown bits above it.
+    //
+    void buildMulti() {
+        multi.assign(entries.empty() ? 0 : (size_t)1 << rootBits, 0);
+        for (uint32_t index = 0; index < multi.size(); index++) {
+            uint32_t bytes = 0;
+            int count = 0;
+            int used = 0;
+            while (count < MULTI_SYMBOLS) {
+                const Entry &e = entries[index >> used];
+                if (e.subBits || e.length == 0 || e.symbol > 255 ||
+                    used + e.length > rootBits)
+                    break;
+                bytes |= (uint32_t)e.symbol << (8 * count);
+                used += e.length;
+                count++;
+            }
+            if (count > 0)
+                multi[index] = bytes | (uint32_t)used << 24 | (uint32_t)count << 28;
+        }
+    }
+
+    //
+    // The slow path for codes longer than ROOT_BITS + SUB_BITS.
+    //
+    template <typename BitInput>
+    int decodeLong(BitInput &in, uint64_t bits) const {
+        for (size_t i = 0; i < longCodes.size(); i++) {
+            const LongCode &lc = longCodes[i];
+            if ((bits & (~0ULL >> (64 - lc.length))) == lc.bits) {
+                in.consume(lc.length);
+                return lc.symbol;
+            }
+        }
+        return -1;
+    }
+
+    vector<Entry> entries;
+    vector<uint32_t> multi;
+    vector<LongCode> longCodes;
+    int rootBits;
+    int maxLength;
+};
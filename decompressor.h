@@ -0,0 +1,205 @@
+//
+// decompressor.h
+// A decompressor that is fed its input in pieces of any size, as they
+// arrive from a pipe or a socket, and hands out the decoded bytes through
+// a buffer the caller owns.  Everything it needs between calls is kept in
+// the object: a header or block head cut off by the end of a piece waits
+// in a small buffer for the rest, and so does a block whose coded bits are
+// not all there yet.  A block is decoded as soon as the last of its bytes
+// arrives, with the same tables as decompress, and its bytes are handed
+// out over as many calls as the caller's buffer needs.  So memory holds
+// about one block, coded and decoded, whatever the size of the stream.
+//
+// It reads the block format (version 2, container.h) front to back and
+// checks the block index at the end against the blocks it decoded.  Files
+// in the older formats have no blocks and are read by decompress.
+//
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+
+using namespace std;
+
+class Decompressor {
+public:
+    enum Status {
+        MORE_INPUT,    // all input was taken and all output handed out
+        MORE_OUTPUT,   // the output buffer is full; call again for the rest
+        FINISHED,      // the stream ended and all of it was handed out
+        FAILED         // the stream is damaged or in an unknown format
+    };
+
+    Decompressor() : state(HEADER), interleaved(false), blockSize(0), needed(0),
+                     outPos(0), offset(0), endMarker(0) {}
+
+    //
+    // decode:
+    //
+    // Takes input from the inLength bytes at in and writes decoded bytes to
+    // the capacity bytes at out, and sets consumed and produced to how many
+    // of each it used.  Input that is not consumed must be passed again.
+    // Returns what the caller should do next (see Status).
+    //
+    Status decode(const char* in, size_t inLength, size_t &consumed,
+                  char* out, size_t capacity, size_t &produced) {
+        consumed = 0;
+        produced = 0;
+        while (true) {
+            // hand out what has been decoded first
+            size_t n = min(capacity - produced, decoded.size() - outPos);
+            memcpy(out + produced, decoded.data() + outPos, n);
+            produced += n;
+            outPos += n;
+            if (outPos < decoded.size())
+                return MORE_OUTPUT;
+            if (state == DONE)
+                return FINISHED;
+            if (state == BROKEN)
+                return FAILED;
+            const unsigned char* next = (const unsigned char*)in + consumed;
+            size_t left = inLength - consumed;
+            size_t used;
+            Step step;
+            if (pending.empty()) {
+                // parts that arrived whole are parsed where they are
+                if (left == 0)
+                    return MORE_INPUT;
+                step = parse(next, left, used);
+                if (step == NEED_BYTES) {
+                    pending.assign((const char*)next, left);
+                    consumed = inLength;
+                    return MORE_INPUT;
+                }
+                consumed += used;
+            } else {
+                // add no more than the part lacks, as far as is known
+                size_t take = min(left, wanted());
+                pending.append((const char*)next, take);
+                consumed += take;
+                step = parse((const unsigned char*)pending.data(), pending.size(), used);
+                if (step == NEED_BYTES) {
+                    if (consumed == inLength)
+                        return MORE_INPUT;
+                    continue;
+                }
+                // bytes taken beyond the part start the next one
+                pending.erase(0, used);
+            }
+            if (step == BAD)
+                state = BROKEN;
+        }
+    }
+
+private:
+    enum State { HEADER, BLOCK, INDEX, DONE, BROKEN };
+    enum Step { PARSED, NEED_BYTES, BAD };
+
+    // The longest a header can be, and a block head before its bits.
+    static const size_t MAX_HEADER = sizeof(CONTAINER_MAGIC) + 2 + 10;
+    static const size_t MAX_BLOCK_HEAD = 2 * 10 + PSEUDO_EOF + 1;
+
+    Decompressor(const Decompressor&);
+    Decompressor& operator=(const Decompressor&);
+
+    //
+    // How many more bytes to collect in pending before trying again: the
+    // rest of the block once its size is known, otherwise enough for any
+    // head.
+    //
+    size_t wanted() const {
+        if (state == BLOCK && pending.size() < needed)
+            return needed - pending.size();
+        return MAX_BLOCK_HEAD;
+    }
+
+    //
+    // Parses the next part of the stream from the size bytes at data and
+    // sets used to how many bytes it took.  Returns NEED_BYTES if they end
+    // before the part does, and BAD if the part is damaged.
+    //
+    Step parse(const unsigned char* data, size_t size, size_t &used) {
+        used = 0;
+        spanbuf buf(data, size);
+        istream in(&buf);
+        if (state == HEADER) {
+            ContainerHeader header;
+            if (!readHeader(in, header))
+                return in.eof() && size < MAX_HEADER ? NEED_BYTES : BAD;
+            if (header.version != CONTAINER_VERSION)
+                return BAD;
+            interleaved = (header.flags & INTERLEAVED_FLAG) != 0;
+            blockSize = header.blockSize;
+            state = BLOCK;
+        } else if (state == BLOCK) {
+            needed = 0;
+            uint64_t rawSize, codedSize;
+            HuffmanCode codes[PSEUDO_EOF + 1];
+            if (!readVarint(in, rawSize))
+                return in.eof() ? NEED_BYTES : BAD;
+            if (rawSize == 0) {  // the end marker
+                state = INDEX;
+                endMarker = offset;
+                offset += 1;
+                used = 1;
+                return PARSED;
+            }
+            if (!readVarint(in, codedSize) || !readCodeLengths(in, codes))
+                return in.eof() && size < MAX_BLOCK_HEAD ? NEED_BYTES : BAD;
+            // no code is longer than 8 bytes, so neither is a block much
+            // longer than 8 times its size
+            if (rawSize > blockSize || codedSize > 8 * blockSize + MAX_BLOCK_HEAD)
+                return BAD;
+            needed = (size_t)in.tellg() + (size_t)codedSize;
+            if (size < needed)
+                return NEED_BYTES;
+            if (!_decodeBlock(data, needed, blockSize, interleaved, table, decoded))
+                return BAD;
+            outPos = 0;
+            BlockEntry entry = {offset, needed, rawSize};
+            blocks.push_back(entry);
+            used = needed;
+            needed = 0;
+        } else if (state == INDEX) {
+            uint64_t count;
+            if (!readVarint(in, count))
+                return in.eof() ? NEED_BYTES : BAD;
+            if (count != blocks.size())
+                return BAD;
+            for (size_t i = 0; i < blocks.size(); i++) {
+                uint64_t storedSize, rawSize;
+                if (!readVarint(in, storedSize) || !readVarint(in, rawSize))
+                    return in.eof() ? NEED_BYTES : BAD;
+                if (storedSize != blocks[i].storedSize || rawSize != blocks[i].rawSize)
+                    return BAD;
+            }
+            unsigned char trailer[TRAILER_SIZE];
+            if (!in.read((char*)trailer, sizeof(trailer)))
+                return NEED_BYTES;
+            if (LoadLE64(trailer) != endMarker
+                || memcmp(trailer + 8, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0)
+                return BAD;
+            state = DONE;
+        }
+        if (used == 0)
+            used = (size_t)in.tellg();
+        offset += used;
+        return PARSED;
+    }
+
+    State state;
+    bool interleaved;
+    uint64_t blockSize;
+    string pending;           // bytes of a part that is not complete yet
+    size_t needed;            // bytes of the current block, once known
+    string decoded;           // the last block decoded
+    size_t outPos;            // how much of it has been handed out
+    decodetable table;
+    vector<BlockEntry> blocks;
+    uint64_t offset;          // where the next part starts in the stream
+    uint64_t endMarker;       // where the end marker was
+};
@@ -0,0 +1,229 @@
+//
+// encodekernel.h
+// These are the inner loops of the Huffman encoder.  Looking codes up and
+// appending them one symbol at a time makes every append wait on the bit
+// position left by the one before, so the kernels here look up several
+// input bytes at once and merge their codes with shifts into one value
+// that is appended with a single writeBits call.  There is an AVX2 kernel
+// (8 bytes per step, gathered lookups), an SSE4.1 kernel (4 bytes per
+// step) and a portable scalar kernel; the best one the CPU supports is
+// picked at runtime.  All of them produce exactly the same bits.
+//
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define ENCODEKERNEL_X86 1
+#endif
+
+using namespace std;
+
+// A code packed for the bit writers: bits holds the code in the order it is
+// written, first bit in the least significant position, and length is the
+// number of bits.  Codes are at most 64 bits long.
+struct HuffmanCode {
+    uint64_t bits;
+    int length;
+};
+
+// Four codes of at most this length fit in one writeBits call (57 bits).
+const int KERNEL_MAX_CODE_LENGTH = 14;
+
+enum EncodeKernel { KERNEL_AUTO, KERNEL_SCALAR, KERNEL_SSE4, KERNEL_AVX2 };
+
+//
+// Writes one packed code; codes longer than one writeBits call allows are
+// split in two.
+//
+template <typename BitOutput>
+inline void writeCode(BitOutput &out, const HuffmanCode &code) {
+    if (code.length <= 32) {
+        out.writeBits(code.bits, code.length);
+    } else {
+        out.writeBits(code.bits, 32);
+        out.writeBits(code.bits >> 32, code.length - 32);
+    }
+}
+
+//
+// Portable kernel: four lookups, then the codes are shifted into place
+// relative to each other and written as one value.  Each entry of table is
+// code | length << 16.  Returns how many symbols were written.
+//
+template <typename BitOutput>
+size_t _encodeScalar(const unsigned char* data, size_t length,
+                     const uint32_t table[256], BitOutput &out) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        uint32_t e0 = table[data[i]], e1 = table[data[i + 1]];
+        uint32_t e2 = table[data[i + 2]], e3 = table[data[i + 3]];
+        int l0 = e0 >> 16, l1 = e1 >> 16, l2 = e2 >> 16, l3 = e3 >> 16;
+        uint64_t v = (uint64_t)(e0 & 0xFFFF)
+                   | (uint64_t)(e1 & 0xFFFF) << l0
+                   | (uint64_t)(e2 & 0xFFFF) << (l0 + l1)
+                   | (uint64_t)(e3 & 0xFFFF) << (l0 + l1 + l2);
+        out.writeBits(v, l0 + l1 + l2 + l3);
+    }
+    return i;
+}
+
+#ifdef ENCODEKERNEL_X86
+//
+// SSE4.1 kernel: the four entries of a step sit in one register as two
+// 64-bit lanes of (even, odd) symbol pairs.  SSE has no per-lane variable
+// shift, so the odd code of each pair is shifted by multiplying it with
+// 2^(even length), built with the float exponent trick.  The two pairs are
+// then joined in a general register.
+//
+template <typename BitOutput>
+__attribute__((target("sse4.1")))
+size_t _encodeSSE4(const unsigned char* data, size_t length,
+                   const uint32_t table[256], BitOutput &out) {
+    const __m128i codeMask = _mm_set1_epi32(0xFFFF);
+    const __m128i lowMask = _mm_set1_epi64x(0xFFFFFFFF);
+    const __m128i bias = _mm_set1_epi32(127);
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m128i e = _mm_setr_epi32(table[data[i]], table[data[i + 1]],
+                                   table[data[i + 2]], table[data[i + 3]]);
+        __m128i code = _mm_and_si128(e, codeMask);
+        __m128i len = _mm_srli_epi32(e, 16);
+        __m128i evenLen = _mm_and_si128(len, lowMask);
+        __m128i pow2 = _mm_cvttps_epi32(_mm_castsi128_ps(
+            _mm_slli_epi32(_mm_add_epi32(evenLen, bias), 23)));
+        __m128i pair = _mm_or_si128(_mm_and_si128(code, lowMask),
+                                    _mm_mul_epu32(_mm_srli_epi64(code, 32), pow2));
+        __m128i pairLen = _mm_add_epi64(evenLen, _mm_srli_epi64(len, 32));
+        uint64_t p0 = (uint64_t)_mm_cvtsi128_si64(pair);
+        uint64_t p1 = (uint64_t)_mm_extract_epi64(pair, 1);
+        int l0 = _mm_cvtsi128_si32(pairLen);
+        int l1 = _mm_extract_epi32(pairLen, 2);
+        out.writeBits(p0 | p1 << l0, l0 + l1);
+    }
+    return i;
+}
+
+//
+// AVX2 kernel: eight bytes are widened and their entries gathered in one
+// instruction.  Pairs are merged in 64-bit lanes with a variable shift,
+// then neighbouring pairs are merged the same way, which leaves two values
+// of four codes each.
+//
+template <typename BitOutput>
+__attribute__((target("avx2")))
+size_t _encodeAVX2(const unsigned char* data, size_t length,
+                   const uint32_t table[256], BitOutput &out) {
+    const __m256i codeMask = _mm256_set1_epi32(0xFFFF);
+    const __m256i lowMask = _mm256_set1_epi64x(0xFFFFFFFF);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i*)(data + i));
+        __m256i e = _mm256_i32gather_epi32((const int*)table,
+                                           _mm256_cvtepu8_epi32(bytes), 4);
+        __m256i code = _mm256_and_si256(e, codeMask);
+        __m256i len = _mm256_srli_epi32(e, 16);
+        __m256i evenLen = _mm256_and_si256(len, lowMask);
+        __m256i pair = _mm256_or_si256(_mm256_and_si256(code, lowMask),
+            _mm256_sllv_epi64(_mm256_srli_epi64(code, 32), evenLen));
+        __m256i pairLen = _mm256_add_epi64(evenLen, _mm256_srli_epi64(len, 32));
+        __m256i quad = _mm256_or_si256(pair,
+            _mm256_sllv_epi64(_mm256_srli_si256(pair, 8), pairLen));
+        __m256i quadLen = _mm256_add_epi64(pairLen, _mm256_srli_si256(pairLen, 8));
+        out.writeBits((uint64_t)_mm256_extract_epi64(quad, 0),
+                      (int)_mm256_extract_epi64(quadLen, 0));
+        out.writeBits((uint64_t)_mm256_extract_epi64(quad, 2),
+                      (int)_mm256_extract_epi64(quadLen, 2));
+    }
+    return i;
+}
+#endif
+
+//
+// The kernel setting shared by all encoders.  KERNEL_AUTO means the best
+// one this CPU supports.
+//
+inline EncodeKernel &_encodeKernelSetting() {
+    static EncodeKernel kernel = KERNEL_AUTO;
+    return kernel;
+}
+
+//
+// Forces a particular kernel, e.g. to compare them.  Asking for one the
+// CPU lacks falls back to the next best.
+//
+inline void setEncodeKernel(EncodeKernel kernel) {
+    _encodeKernelSetting() = kernel;
+}
+
+//
+// Returns the kernel encodeSymbols will actually use.
+//
+inline EncodeKernel activeEncodeKernel() {
+    EncodeKernel wanted = _encodeKernelSetting();
+#ifdef ENCODEKERNEL_X86
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    static const bool hasSSE4 = __builtin_cpu_supports("sse4.1");
+    if ((wanted == KERNEL_AUTO || wanted == KERNEL_AVX2) && hasAVX2)
+        return KERNEL_AVX2;
+    if (wanted != KERNEL_SCALAR && hasSSE4)
+        return KERNEL_SSE4;
+#else
+    (void)wanted;
+#endif
+    return KERNEL_SCALAR;
+}
+
+//
+// Passes bits on to a writer and keeps count of them.
+//
+template <typename BitOutput>
+struct _countingOutput {
+    BitOutput &out;
+    uint64_t bits;
+    void writeBits(uint64_t value, int nbits) {
+        bits += nbits;
+        out.writeBits(value, nbits);
+    }
+};
+
+//
+// Encodes length bytes starting at data into out with the codes in table
+// (indexed by byte value) and returns the number of bits written.  When
+// every code is short enough the symbols go through the fastest
+// multi-symbol kernel; otherwise, and for the last few symbols, they are
+// written one at a time.
+//
+template <typename BitOutput>
+uint64_t encodeSymbols(const unsigned char* data, size_t length,
+                       const HuffmanCode table[], BitOutput &output) {
+    _countingOutput<BitOutput> out = {output, 0};
+    uint32_t packed[256];
+    bool fits = true;
+    for (int i = 0; i < 256; i++) {
+        fits = fits && table[i].length <= KERNEL_MAX_CODE_LENGTH;
+        packed[i] = (uint32_t)(table[i].bits & 0xFFFF) | (uint32_t)table[i].length << 16;
+    }
+    size_t done = 0;
+    if (fits) {
+        switch (activeEncodeKernel()) {
+#ifdef ENCODEKERNEL_X86
+        case KERNEL_AVX2:
+            done = _encodeAVX2(data, length, packed, out);
+            break;
+        case KERNEL_SSE4:
+            done = _encodeSSE4(data, length, packed, out);
+            break;
+#endif
+        default:
+            done = _encodeScalar(data, length, packed, out);
+            break;
+        }
+    }
+    for (size_t i = done; i < length; i++) {
+        writeCode(out, table[data[i]]);
+    }
+    return out.bits;
+}
@@ -1,45 +1,530 @@
+//
+// hashmap.h
+// A hash map with open addressing in the style of Swiss tables.  Keys and
+// values live in one flat slot array; beside it is an array of one control
+// byte per slot, which is either EMPTY or the low 7 bits of the hash of the
+// key in that slot.  A lookup loads the control bytes of a group of 16
+// slots and compares all of them with the key's 7 hash bits at once, so it
+// only has to look at the slots whose bits match, and it can stop at the
+// first group with an empty slot.  The table doubles whenever it would get
+// more than 7/8 full.  A map that has never had a key put in it, or has
+// been moved from, owns no table at all.
+//
+// Member functions are defined below the class.  hashmap.cpp instantiates
+// hashmap<int, int> once for the whole program.
+//
 #pragma once
 
 #include <vector>
+#include <string>
+#include <sstream>
 #include <ostream>
 #include <istream>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+template <typename K, typename V>
 class hashmap
 {
 public:
+    // what iterators point to; the key must not be changed through them
+    struct key_val_pair {
+        K key;
+        V value;
+    };
+
+    //
+    // Walks the full slots in table order, skipping the empty ones by their
+    // control bytes.  Slot is key_val_pair or const key_val_pair.
+    //
+    template <typename Slot>
+    class slot_iterator {
+    public:
+        slot_iterator(const int8_t* control, Slot* slot, Slot* end)
+            : control(control), slot(slot), end(end) {
+            skipEmpty();
+        }
+        Slot& operator*() const { return *slot; }
+        Slot* operator->() const { return slot; }
+        slot_iterator& operator++() {
+            ++slot;
+            ++control;
+            skipEmpty();
+            return *this;
+        }
+        bool operator==(const slot_iterator &other) const { return slot == other.slot; }
+        bool operator!=(const slot_iterator &other) const { return slot != other.slot; }
+    private:
+        void skipEmpty() {
+            while (slot != end && *control == EMPTY) {
+                ++slot;
+                ++control;
+            }
+        }
+        const int8_t* control;
+        Slot* slot;
+        Slot* end;
+    };
+    typedef slot_iterator<key_val_pair> iterator;
+    typedef slot_iterator<const key_val_pair> const_iterator;
+
     hashmap();
     ~hashmap();
 
-    int get(int key) const;
-    void put(int key, int value);
-    bool containsKey(int key);
-    vector<int> keys() const;
-    int size();
+    const V& get(const K &key) const;
+    void put(const K &key, const V &value);
+    bool containsKey(const K &key) const;
+    vector<K> keys() const;
+    int size() const;
+    void reserve(int count);  // room for count keys without growing
+
+    // inserts key with value unless key is already there; either way
+    // returns where key is and whether it was inserted
+    pair<iterator, bool> try_emplace(const K &key, const V &value = V());
+    // adds delta to the value of key, which starts at V() if it is new
+    void increment(const K &key, const V &delta);
+
+    iterator begin() { return iterator(control, slots, slots + nSlots); }
+    iterator end() { return iterator(control + nSlots, slots + nSlots, slots + nSlots); }
+    const_iterator begin() const { return const_iterator(control, slots, slots + nSlots); }
+    const_iterator end() const {
+        return const_iterator(control + nSlots, slots + nSlots, slots + nSlots);
+    }
 
-    void sanityCheck();
+    void sanityCheck() const;
     hashmap(const hashmap &myMap); // copy constructor
     hashmap& operator= (const hashmap &myMap); // equals operator
+    hashmap(hashmap &&myMap) noexcept; // move constructor
+    hashmap& operator= (hashmap &&myMap) noexcept; // move assignment
     // overloads the << operator, which is VERY useful printing the hashmap
     // or writing it to a stream/file.
-    friend ostream &operator<<(ostream &out, hashmap &myMap);
+    template <typename K2, typename V2>
+    friend ostream &operator<<(ostream &out, hashmap<K2, V2> &myMap);
     // overloads the >> operator, which is VERY useful for extracting it from
     // streams/files.
-    friend istream &operator>>(istream &in, hashmap &myMap);
+    template <typename K2, typename V2>
+    friend istream &operator>>(istream &in, hashmap<K2, V2> &myMap);
 private:
-    struct key_val_pair {
-        int key;
-        int value;
-        key_val_pair* next;
-    };
+    static const int GROUP_SIZE = 16;
+    static const int8_t EMPTY = -128;  // full slots hold 0 to 127
 
-    typedef key_val_pair** bucketArray; 
+    void allocate(int nSlots);
+    void release();
+    void copyFrom(const hashmap &myMap);
+    void stealFrom(hashmap &myMap);
+    void grow(int nSlots);
+    size_t hashFunction(const K &key) const;
+    uint32_t matchGroup(size_t group, int8_t tag) const;
+    int findSlot(const K &key, size_t hash) const;
+    int insertSlot(size_t hash);
 
-    bucketArray createBucketArray(int nBuckets);
-    int hashFunction(int input) const;
+    int8_t* control;        // one byte per slot
+    key_val_pair* slots;
 
-    bucketArray buckets;
-
-    int nBuckets;
+    int nSlots;             // 0, or a power of two of at least GROUP_SIZE
     int nElems;
 };
+
+//
+// This constructor makes an empty map; the first put allocates its table.
+//
+template <typename K, typename V>
+hashmap<K, V>::hashmap()
+    : control(nullptr), slots(nullptr), nSlots(0), nElems(0) {
+}
+
+//
+// This destructor frees the slot and control arrays.
+//
+template <typename K, typename V>
+hashmap<K, V>::~hashmap() {
+    release();
+}
+
+//
+// Allocates an empty table of nSlots slots.
+//
+template <typename K, typename V>
+void hashmap<K, V>::allocate(int nSlots) {
+    this->nSlots = nSlots;
+    this->nElems = 0;
+    control = new int8_t[nSlots];
+    memset(control, EMPTY, nSlots);
+    slots = new key_val_pair[nSlots];
+}
+
+template <typename K, typename V>
+void hashmap<K, V>::release() {
+    delete[] control;
+    delete[] slots;
+    control = nullptr;
+    slots = nullptr;
+    nSlots = 0;
+    nElems = 0;
+}
+
+//
+// Makes this map, which must own no table, a copy of myMap.  The control
+// bytes and slots are copied as they are, so nothing is rehashed.
+//
+template <typename K, typename V>
+void hashmap<K, V>::copyFrom(const hashmap &myMap) {
+    if (myMap.nSlots == 0)
+        return;
+    allocate(myMap.nSlots);
+    memcpy(control, myMap.control, nSlots);
+    copy(myMap.slots, myMap.slots + nSlots, slots);
+    nElems = myMap.nElems;
+}
+
+//
+// Takes over the table of myMap, which is left owning none.
+//
+template <typename K, typename V>
+void hashmap<K, V>::stealFrom(hashmap &myMap) {
+    control = myMap.control;
+    slots = myMap.slots;
+    nSlots = myMap.nSlots;
+    nElems = myMap.nElems;
+    myMap.control = nullptr;
+    myMap.slots = nullptr;
+    myMap.nSlots = 0;
+    myMap.nElems = 0;
+}
+
+//
+// Moves every element into a new table of nSlots slots.
+//
+template <typename K, typename V>
+void hashmap<K, V>::grow(int nSlots) {
+    int8_t* oldControl = control;
+    key_val_pair* oldSlots = slots;
+    int oldN = this->nSlots;
+    allocate(nSlots);
+    for (int i = 0; i < oldN; i++) {
+        if (oldControl[i] != EMPTY) {
+            size_t hash = hashFunction(oldSlots[i].key);
+            slots[insertSlot(hash)] = move(oldSlots[i]);
+            nElems++;
+        }
+    }
+    delete[] oldControl;
+    delete[] oldSlots;
+}
+
+//
+// Returns a bit mask of the slots in group whose control byte is tag.
+//
+template <typename K, typename V>
+uint32_t hashmap<K, V>::matchGroup(size_t group, int8_t tag) const {
+    const int8_t* bytes = control + group * GROUP_SIZE;
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)bytes);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        if (bytes[i] == tag)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+//
+// Returns the slot holding key, or -1.  The probe visits groups at
+// triangular offsets from the hash's home group, which covers every group
+// of a power-of-two table, and stops at the first group with an empty slot.
+//
+template <typename K, typename V>
+int hashmap<K, V>::findSlot(const K &key, size_t hash) const {
+    if (nElems == 0)  // also covers having no table
+        return -1;
+    size_t groupMask = (size_t)nSlots / GROUP_SIZE - 1;
+    size_t group = (hash >> 7) & groupMask;
+    int8_t tag = (int8_t)(hash & 0x7F);
+    for (size_t probe = 1; ; probe++) {
+        uint32_t match = matchGroup(group, tag);
+        while (match != 0) {
+            int slot = (int)(group * GROUP_SIZE) + __builtin_ctz(match);
+            if (slots[slot].key == key)
+                return slot;
+            match &= match - 1;
+        }
+        if (matchGroup(group, EMPTY) != 0)
+            return -1;
+        group = (group + probe) & groupMask;
+    }
+}
+
+//
+// Claims the first empty slot on the probe sequence of hash, which must
+// not be in the map yet, and returns it.  There always is one, because the
+// table is never full.  Does not count the new element.
+//
+template <typename K, typename V>
+int hashmap<K, V>::insertSlot(size_t hash) {
+    size_t groupMask = (size_t)nSlots / GROUP_SIZE - 1;
+    size_t group = (hash >> 7) & groupMask;
+    for (size_t probe = 1; ; probe++) {
+        uint32_t empty = matchGroup(group, EMPTY);
+        if (empty != 0) {
+            int slot = (int)(group * GROUP_SIZE) + __builtin_ctz(empty);
+            control[slot] = (int8_t)(hash & 0x7F);
+            return slot;
+        }
+        group = (group + probe) & groupMask;
+    }
+}
+
+//
+// This method puts key/value pair in the map, replacing the value if key
+// is already there.
+//
+template <typename K, typename V>
+void hashmap<K, V>::put(const K &key, const V &value) {
+    try_emplace(key, value).first->value = value;
+}
+
+//
+// This method inserts key with value if key is not in the map yet.  It
+// hashes the key once whether or not it inserts.
+//
+template <typename K, typename V>
+pair<typename hashmap<K, V>::iterator, bool>
+hashmap<K, V>::try_emplace(const K &key, const V &value) {
+    size_t hash = hashFunction(key);
+    int slot = findSlot(key, hash);
+    bool inserted = slot < 0;
+    if (inserted) {
+        if ((nElems + 1) * 8 > nSlots * 7) {  // keep the load at most 7/8
+            grow(nSlots == 0 ? GROUP_SIZE : nSlots * 2);
+        }
+        slot = insertSlot(hash);
+        slots[slot].key = key;
+        slots[slot].value = value;
+        nElems++;
+    }
+    return make_pair(iterator(control + slot, slots + slot, slots + nSlots), inserted);
+}
+
+//
+// This method adds delta to the value of key, e.g. to count occurrences.
+//
+template <typename K, typename V>
+void hashmap<K, V>::increment(const K &key, const V &delta) {
+    try_emplace(key).first->value += delta;
+}
+
+//
+// This method returns the value associated with key.
+//
+template <typename K, typename V>
+const V& hashmap<K, V>::get(const K &key) const {
+    int slot = findSlot(key, hashFunction(key));
+    if (slot < 0) {
+        throw("Error: Key is not in map.");
+    }
+    return slots[slot].value;
+}
+
+//
+// This function checks if the key is already in the map.
+//
+template <typename K, typename V>
+bool hashmap<K, V>::containsKey(const K &key) const {
+    return findSlot(key, hashFunction(key)) >= 0;
+}
+
+//
+// This method goes through all slots and adds all keys to a vector.
+//
+template <typename K, typename V>
+vector<K> hashmap<K, V>::keys() const {
+    vector<K> keyVec;
+    keyVec.reserve(nElems);
+    for (int i = 0; i < nSlots; i++) {
+        if (control[i] != EMPTY) {
+            keyVec.push_back(slots[i].key);
+        }
+    }
+    return keyVec;
+}
+
+//
+// This function returns the number of elements in the hashmap.
+//
+template <typename K, typename V>
+int hashmap<K, V>::size() const {
+    return nElems;
+}
+
+//
+// This function grows the table, if needed, so that count keys fit without
+// another rehash.
+//
+template <typename K, typename V>
+void hashmap<K, V>::reserve(int count) {
+    int wanted = nSlots == 0 ? GROUP_SIZE : nSlots;
+    while ((long long)count * 8 > (long long)wanted * 7) {
+        wanted *= 2;
+    }
+    if (wanted != nSlots) {
+        grow(wanted);
+    }
+}
+
+//
+// Checks that the element count is right and that every key can be found
+// from its hash.  Throws if not.
+//
+template <typename K, typename V>
+void hashmap<K, V>::sanityCheck() const {
+    int count = 0;
+    for (int i = 0; i < nSlots; i++) {
+        if (control[i] == EMPTY)
+            continue;
+        count++;
+        size_t hash = hashFunction(slots[i].key);
+        if (control[i] != (int8_t)(hash & 0x7F) || findSlot(slots[i].key, hash) != i) {
+            throw("Error: hashmap slot is corrupt.");
+        }
+    }
+    if (count != nElems) {
+        throw("Error: hashmap size is wrong.");
+    }
+}
+
+//
+// Copy constructor
+//
+template <typename K, typename V>
+hashmap<K, V>::hashmap(const hashmap &myMap)
+    : control(nullptr), slots(nullptr), nSlots(0), nElems(0) {
+    // make a deep copy of the map, slot for slot
+    copyFrom(myMap);
+}
+
+//
+// Equals operator.
+//
+template <typename K, typename V>
+hashmap<K, V>& hashmap<K, V>::operator= (const hashmap &myMap) {
+    // make a deep copy of the map
+
+    // watch for self-assignment
+    if (this == &myMap) {
+        return *this;
+    }
+
+    // if data exists in the map, delete it
+    release();
+    copyFrom(myMap);
+
+    // return the existing object so we can chain this operator
+    return *this;
+}
+
+//
+// Move constructor.  Takes the table of myMap, which is left empty.
+//
+template <typename K, typename V>
+hashmap<K, V>::hashmap(hashmap &&myMap) noexcept {
+    stealFrom(myMap);
+}
+
+//
+// Move assignment.
+//
+template <typename K, typename V>
+hashmap<K, V>& hashmap<K, V>::operator= (hashmap &&myMap) noexcept {
+    if (this != &myMap) {
+        release();
+        stealFrom(myMap);
+    }
+    return *this;
+}
+
+//
+// This function overloads the << operator, which allows for ease in printing
+// to screen or inserting into a stream, in general.
+//
+template <typename K, typename V>
+ostream &operator<<(ostream &out, hashmap<K, V> &myMap) {
+    out << "{";
+    bool first = true;
+    for (auto &e : myMap) {
+        if (!first) { // no commas before the first one
+            out << ", ";
+        }
+        out << e.key << ":" << e.value;
+        first = false;
+    }
+    out << "}";
+    return out;
+}
+
+//
+// This function overloads the >> operator, which allows for ease at extraction
+// from streams/files.
+//
+template <typename K, typename V>
+istream &operator>>(istream &in, hashmap<K, V> &myMap) {
+    // assume the format {1:2, 3:4}
+    bool done = false;
+    in.get(); // get the first char, {
+    int nextChar = in.get(); // get the first real character
+    while (!done) {
+        string nextInput;
+        while (nextChar != ',' and nextChar != '}') {
+                nextInput += nextChar;
+                nextChar = in.get();
+        }
+        if (nextChar == ',') {
+            // read the space as well
+            in.get(); // should be a space
+            nextChar = in.get(); // get the next character
+        } else {
+            done = true; // we have reached }
+        }
+        // at this point, nextInput should be in the form 1:2
+        // (we should have two values separated by a colon)
+        // BUT, we might have an empty map (special case)
+        if (nextInput != "") {
+            size_t pos = nextInput.find(":");
+            K key;
+            V value;
+            istringstream(nextInput.substr(0, pos)) >> key;
+            istringstream(nextInput.substr(pos+1)) >> value;
+            myMap.put(key, value);
+        }
+    }
+    return in;
+}
+
+//
+// The hash function for hashmap implementation.  std::hash is the identity
+// for integers, so its result is mixed with the same kind of "magic number"
+// steps the map always used, widened to 64 bits.  Control bytes take the
+// low 7 bits and the home group the bits above them.
+//
+template <typename K, typename V>
+size_t hashmap<K, V>::hashFunction(const K &key) const {
+    // see https://stackoverflow.com/a/12996028/561677 for details
+    uint64_t temp = (uint64_t)hash<K>()(key);
+    temp = ((temp >> 32) ^ temp) * 0xd6e8feb86659fd93ULL;
+    temp = ((temp >> 32) ^ temp) * 0xd6e8feb86659fd93ULL;
+    temp = (temp >> 32) ^ temp;
+    return (size_t)temp;
+}
+
+extern template class hashmap<int, int>;
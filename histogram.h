@@ -0,0 +1,52 @@
+//
+// histogram.h
+// Counts how often each byte value occurs in a buffer.  Incrementing one
+// count array means that a run of equal bytes makes every increment wait
+// for the store of the one before, so the counts are spread over four
+// arrays that consecutive bytes take turns at, and the arrays are added up
+// at the end.  Input is read eight bytes per load.
+//
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+using namespace std;
+
+//
+// Adds the number of times each byte value occurs in the length bytes
+// starting at data to counts.
+//
+inline void byteHistogram(const unsigned char* data, size_t length,
+                          uint64_t counts[256]) {
+    // 32-bit lanes stay in L1; flushing every BLOCK bytes keeps them from
+    // overflowing
+    const size_t BLOCK = (size_t)1 << 30;
+    uint32_t lanes[4][256];
+    while (length > 0) {
+        size_t n = length < BLOCK ? length : BLOCK;
+        memset(lanes, 0, sizeof(lanes));
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t w;
+            memcpy(&w, data + i, 8);
+            lanes[0][w & 0xFF]++;
+            lanes[1][(w >> 8) & 0xFF]++;
+            lanes[2][(w >> 16) & 0xFF]++;
+            lanes[3][(w >> 24) & 0xFF]++;
+            lanes[0][(w >> 32) & 0xFF]++;
+            lanes[1][(w >> 40) & 0xFF]++;
+            lanes[2][(w >> 48) & 0xFF]++;
+            lanes[3][w >> 56]++;
+        }
+        for (; i < n; i++) {
+            lanes[0][data[i]]++;
+        }
+        for (int b = 0; b < 256; b++) {
+            counts[b] += (uint64_t)lanes[0][b] + lanes[1][b] + lanes[2][b] + lanes[3][b];
+        }
+        data += n;
+        length -= n;
+    }
+}
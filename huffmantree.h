@@ -0,0 +1,75 @@
+//
+// huffmantree.h
+// A Huffman tree whose nodes all live in one fixed array inside the tree
+// object.  Children are 16-bit indices into that array rather than
+// pointers, so a node is 12 bytes and a whole tree a few kilobytes with no
+// heap allocation at all.  Building a tree is one append per node, and
+// throwing it away is resetting a counter, however deep the tree is.
+//
+#pragma once
+
+#include <stdint.h>
+#include "bitstream.h"
+
+using namespace std;
+
+struct HuffmanNode {
+    int character;
+    int count;
+    uint16_t zero;   // index of the child on bit 0, or HuffmanTree::NO_NODE
+    uint16_t one;    // index of the child on bit 1, or HuffmanTree::NO_NODE
+};
+
+class HuffmanTree {
+public:
+    static const uint16_t NO_NODE = 0xFFFF;
+    // a full binary tree over PSEUDO_EOF + 1 symbols has fewer nodes
+    static const int MAX_NODES = 2 * (PSEUDO_EOF + 1);
+
+    //
+    // default constructor:
+    //
+    // Creates an empty tree.
+    //
+    HuffmanTree() : nNodes(0), rootIndex(NO_NODE) {}
+
+    //
+    // makeNode:
+    //
+    // Appends a childless node and returns its index, which is also the
+    // order nodes were made in.  Returns NO_NODE once the tree is full.
+    //
+    uint16_t makeNode(int character, int count) {
+        if (nNodes == MAX_NODES)
+            return NO_NODE;
+        HuffmanNode &node = nodes[nNodes];
+        node.character = character;
+        node.count = count;
+        node.zero = node.one = NO_NODE;
+        return (uint16_t)nNodes++;
+    }
+
+    //
+    // Empties the tree in O(1).
+    //
+    void clear() {
+        nNodes = 0;
+        rootIndex = NO_NODE;
+    }
+
+    HuffmanNode& operator[](uint16_t index) { return nodes[index]; }
+    const HuffmanNode& operator[](uint16_t index) const { return nodes[index]; }
+    bool isLeaf(uint16_t index) const {
+        return nodes[index].zero == NO_NODE && nodes[index].one == NO_NODE;
+    }
+
+    uint16_t root() const { return rootIndex; }
+    void setRoot(uint16_t index) { rootIndex = index; }
+    bool empty() const { return rootIndex == NO_NODE; }
+    int size() const { return nNodes; }
+
+private:
+    HuffmanNode nodes[MAX_NODES];
+    int nNodes;
+    uint16_t rootIndex;
+};
@@ -11,16 +11,19 @@
 
 #include <iostream>
 #include <map>
-#include <unordered_map>
 #include <fstream>
 #include <queue>
 #include <vector>
 #include <functional>
 #include <ctype.h>
 #include <math.h>
+#include <iomanip>
 #include "hashmap.h"
 #include "bitstream.h"
 #include "util.h"
+#include "batch.h"
+#include "compressor.h"
+#include "decompressor.h"
 
 using namespace std;
 
@@ -29,20 +32,38 @@ string menu();
 bool is123456(string choice);
 void do123456(string choice, string &filename, bool &isFile,
              hashmapF &frequencyMap,
-             HuffmanNode* &encodingTree,
-             hashmapE &encodingMap);
+             HuffmanTree &encodingTree,
+             EncodingTable &encodingMap);
 string printChar(int val);
-void printMap(hashmapE &map);
+void printMap(EncodingTable &map);
 void printMap(hashmapF &map);
-void printTree(HuffmanNode* node, string str);
+void printTree(HuffmanTree &tree, int node, string str);
 void printTextFile(string filename);
 void printBinaryFile(string filename);
+void printLengthLimitCost(string filename, const CompressOptions &options);
+bool printCodingStats(ostream &out, string filename, const CompressOptions &options);
+int batchCommand(int argc, char** argv);
+int compressCommand(int argc, char** argv);
+int decompressCommand();
+int statsCommand(int argc, char** argv);
 
-int main() {
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "batch") {
+        return batchCommand(argc - 2, argv + 2);
+    }
+    if (argc > 1 && string(argv[1]) == "compress") {
+        return compressCommand(argc - 2, argv + 2);
+    }
+    if (argc > 1 && string(argv[1]) == "decompress") {
+        return decompressCommand();
+    }
+    if (argc > 1 && string(argv[1]) == "stats") {
+        return statsCommand(argc - 2, argv + 2);
+    }
     
     hashmapF frequencyMap;
-    HuffmanNode* encodingTree = nullptr;
-    hashmapE encodingMap;
+    HuffmanTree encodingTree;
+    EncodingTable encodingMap;
     string filename;
     bool isFile = true;
     
@@ -57,10 +78,22 @@ int main() {
             cout << "Enter filename: ";
             cin >> filename;
             compress(filename);
+        } else if (choice == "L") {
+            cout << "Enter filename: ";
+            cin >> filename;
+            CompressOptions options;
+            cout << "Enter maximum code length: ";
+            cin >> options.maxCodeLength;
+            compress(filename, false, options);
+            printLengthLimitCost(filename, options);
         } else if (choice == "D") {
             cout << "Enter filename: ";
             cin >> filename;
             decompress(filename);
+        } else if (choice == "S") {
+            cout << "Enter filename: ";
+            cin >> filename;
+            printCodingStats(cout, filename, CompressOptions());
         } else if (choice == "B") {
             cout << "Enter filename: ";
             cin >> filename;
@@ -89,7 +122,9 @@ string menu() {
     cout << "6.  Free tree memory" << endl;
     cout << endl;
     cout << "C.  Compress file" << endl;
+    cout << "L.  Compress file with limited code lengths" << endl;
     cout << "D.  Decompress file" << endl;
+    cout << "S.  Compress and decompress file with stats" << endl;
     cout << endl;
     cout << "B.  Binary file viewer" << endl;
     cout << "T.  Text file viewer" << endl;
@@ -121,8 +156,8 @@ bool is123456(string choice) {
 //
 void do123456(string choice, string &filename, bool &isFile,
              hashmapF &frequencyMap,
-             HuffmanNode* &encodingTree,
-             hashmapE &encodingMap) {
+             HuffmanTree &encodingTree,
+             EncodingTable &encodingMap) {
     // gets file/string and filename.
     if (choice == "1") {
         cout << "[F]ilename or [S]tring? ";
@@ -148,7 +183,7 @@ void do123456(string choice, string &filename, bool &isFile,
         encodingTree = buildEncodingTree(frequencyMap);
         cout << endl;
         cout << "Building encoding tree..." << endl;
-        printTree(encodingTree, "");
+        printTree(encodingTree, encodingTree.root(), "");
         cout << endl;
     // Build Encoding Map
     } else if (choice == "3") {
@@ -175,15 +210,21 @@ void do123456(string choice, string &filename, bool &isFile,
         string fn = (isFile) ? filename : ("file_" + filename + ".txt");
         
         ofbitstream output(filename + ".huf");
-        ifstream input(filename);
+        mappedfile input(filename);
         
+        // the header holds the original size and every code length
+        ContainerHeader header = {};
+        header.version = SINGLE_CODE_VERSION;
+        header.originalSize = input.size();
+        copy(encodingMap.codes, encodingMap.codes + PSEUDO_EOF + 1, header.codes);
         stringstream ss;
-        // note: << is overloaded for the hashmap class.  super nice!
-        ss << frequencyMap;
-        output << frequencyMap;  // add the frequency map to the file
-        int size = 0;
-        string codeStr = encode(input, encodingMap, output, size, true);
-        // count bytes in frequency map header
+        writeHeader(ss, header);
+        writeHeader(output, header);  // add the header to the file
+        size_t size = 0;
+        // ask for the string too, it is printed below
+        string codeStr = encode((const char*)input.data(), input.size(),
+                                encodingMap, output, size, true, true);
+        // count bytes in header
         size = ss.str().length() + ceil((double)size / 8);
         cout << "Compressed file size: " << size << endl;
         cout << codeStr << endl;
@@ -213,17 +254,18 @@ void do123456(string choice, string &filename, bool &isFile,
         ifbitstream input(filename + ext + ".huf");
         ofstream output(filename + "_unc" + ext);
         
-        hashmapF dump;
-        input >> dump;  // get rid of frequency map at top of file
+        ContainerHeader dump;
+        readHeader(input, dump);  // get rid of header at top of file
         
-        string decodeStr  = decode(input, encodingTree, output);
+        // ask for the string too, it is printed below
+        string decodeStr  = decode(input, encodingTree, output, true);
         cout << decodeStr << endl;
         cout << endl;
         output.close(); // must close file so autograder can open for testing
     // Free the Encoding Tree
     } else if (choice == "6") {
         cout << "Freeing encoding tree..." << endl;
-        freeTree(encodingTree);
+        encodingTree.clear();
     }
 }
 
@@ -261,9 +303,9 @@ string printChar(int ch){
 //
 //
 void printMap(hashmapF &map) {
-    for (int key : map.keys()) {
-        cout << key << ": " << '\t' << printChar(key);
-        cout << '\t' << "-->" << '\t' << map.get(key) << endl;
+    for (auto &e : map) {
+        cout << e.key << ": " << '\t' << printChar(e.key);
+        cout << '\t' << "-->" << '\t' << e.value << endl;
     }
 }
 
@@ -271,10 +313,12 @@ void printMap(hashmapF &map) {
 // printEncodingMap
 //
 //
-void printMap(hashmapE &map) {
-    for (auto e : map) {
-        cout << e.first << ": " << '\t' << printChar(e.first);
-        cout << '\t' << "-->" << '\t' << e.second << endl;
+void printMap(EncodingTable &map) {
+    for (int symbol = 0; symbol <= PSEUDO_EOF; symbol++) {
+        if (map[symbol].length == 0)
+            continue;
+        cout << symbol << ": " << '\t' << printChar(symbol);
+        cout << '\t' << "-->" << '\t' << _codeString(map[symbol]) << endl;
     }
 }
 
@@ -282,16 +326,16 @@ void printMap(hashmapE &map) {
 // printTree
 //
 //
-void printTree(HuffmanNode* node, string str) {
-    if (node == nullptr) {
+void printTree(HuffmanTree &tree, int node, string str) {
+    if (node == HuffmanTree::NO_NODE) {
         return;
     } else {
-        cout << str << "{" << printChar(node->character);
-        if (node->character != NOT_A_CHAR)
-            cout << "(" << node->character << ")";
-        cout << ", count=" << node->count << "}" << endl;
-        printTree(node->zero, str+" ");
-        printTree(node->one, str+" ");
+        cout << str << "{" << printChar(tree[node].character);
+        if (tree[node].character != NOT_A_CHAR)
+            cout << "(" << tree[node].character << ")";
+        cout << ", count=" << tree[node].count << "}" << endl;
+        printTree(tree, tree[node].zero, str+" ");
+        printTree(tree, tree[node].one, str+" ");
     }
 }
 
@@ -338,3 +382,202 @@ void printBinaryFile(string filename) {
     }
     cout << endl;
 }
+
+//
+// printLengthLimitCost
+// Prints how much limiting the codes of filename to options.maxCodeLength
+// bits costs in the size of the blocks compress writes with options.
+//
+void printLengthLimitCost(string filename, const CompressOptions &options) {
+    mappedfile input(filename);
+    int limit;
+    double cost = lengthLimitCost((const char*)input.data(), input.size(), options,
+                                  limit);
+    if (limit == 0) {
+        cout << "Codes are not limited." << endl;
+        return;
+    }
+    cout << "Limiting codes to " << limit << " bits";
+    if (limit != options.maxCodeLength)
+        cout << " (" << options.maxCodeLength << " cannot fit every byte of some blocks)";
+    cout << " makes the data ";
+    cout << fixed << setprecision(3) << cost * 100 << "% larger than ";
+    cout << "unlimited Huffman codes." << endl;
+    cout.unsetf(ios::floatfield);
+}
+
+//
+// printCodingStats
+// Compresses filename with options and decompresses the result, and
+// prints the sizes and stage times of both to out as one JSON object.  The
+// .huf and _unc files made on the way are removed again.  Returns whether
+// both steps succeeded.
+//
+bool printCodingStats(ostream &out, string filename, const CompressOptions &options) {
+    CodingStats compressStats, decompressStats;
+    bool compressed = false, decompressed = false;
+    compress(filename, false, options, &compressStats, &compressed);
+    if (compressed)
+        decompress(filename + ".huf", false, &decompressStats, &decompressed);
+    remove((filename + ".huf").c_str());
+    remove(_decompressedName(filename).c_str());
+    out << "{\"file\": ";
+    writeJsonString(out, filename);
+    out << ", \"ok\": " << (compressed && decompressed ? "true" : "false")
+        << ", \"compress\": ";
+    compressStats.writeJson(out);
+    out << ", \"decompress\": ";
+    decompressStats.writeJson(out);
+    out << "}" << endl;
+    return compressed && decompressed;
+}
+
+//
+// batchCommand
+// Runs "program.exe batch [-d] [-j threads] [-l listfile] [paths...]",
+// which compresses (or with -d decompresses) every file named by the
+// paths, directories meaning all files under them, and by the lines of
+// the list files.  Prints what was done and returns 1 if any file failed.
+//
+int batchCommand(int argc, char** argv) {
+    BatchOptions options;
+    vector<string> files;
+    for (int i = 0; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-d") {
+            options.decompress = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "-l" && i + 1 < argc) {
+            if (!addBatchList(argv[++i], files)) {
+                cerr << "Cannot read file list " << argv[i] << endl;
+                return 1;
+            }
+        } else {
+            addBatchSource(arg, files);
+        }
+    }
+    if (files.empty()) {
+        cerr << "usage: program.exe batch [-d] [-j threads] [-l listfile] [paths...]"
+             << endl;
+        return 1;
+    }
+    BatchReport report = runBatch(files, options);
+    double seconds = report.seconds > 0 ? report.seconds : 1e-9;
+    cout << report.files - report.failed.size() << " of " << report.files
+         << " files " << (options.decompress ? "decompressed" : "compressed")
+         << ", " << report.inputBytes << " bytes in, " << report.outputBytes
+         << " bytes out, in " << fixed << setprecision(3) << seconds << " s ("
+         << setprecision(1) << report.inputBytes / seconds / 1e6 << " MB/s)" << endl;
+    for (size_t i = 0; i < report.failed.size(); i++) {
+        cerr << "failed: " << report.failed[i] << endl;
+    }
+    return report.failed.empty() ? 0 : 1;
+}
+
+//
+// compressCommand
+// Runs "program.exe compress [-b blockSize]", which compresses standard
+// input to standard output as it arrives, e.g. in "app | program.exe
+// compress > out.huf".  Returns 1 if the output cannot be written, and 2,
+// after printing how to run it, if the arguments are not understood.
+//
+int compressCommand(int argc, char** argv) {
+    CompressOptions options;
+    for (int i = 0; i < argc; i += 2) {
+        // -b is the only flag, and its value must be a plain number
+        bool ok = string(argv[i]) == "-b" && i + 1 < argc
+                  && isdigit((unsigned char)argv[i + 1][0]);
+        if (ok) {
+            char* end;
+            options.blockSize = strtoull(argv[i + 1], &end, 10);
+            ok = *end == '\0';
+        }
+        if (!ok) {
+            cerr << "usage: program.exe compress [-b blockSize] < input > output.huf"
+                 << endl;
+            return 2;
+        }
+    }
+    Compressor compressor(cout, options);
+    vector<char> chunk(1 << 16);
+    size_t got;
+    while ((got = fread(&chunk[0], 1, chunk.size(), stdin)) > 0) {
+        if (!compressor.write(&chunk[0], got))
+            break;
+    }
+    if (!compressor.finish()) {
+        cerr << "Cannot write the compressed output" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// decompressCommand
+// Runs "program.exe decompress", which decompresses standard input to
+// standard output as it arrives, e.g. in "nc host port | program.exe
+// decompress > out".  Returns 1 if the input is damaged or ends early.
+//
+int decompressCommand() {
+    Decompressor decompressor;
+    vector<char> chunk(1 << 16), decoded(1 << 16);
+    Decompressor::Status status = Decompressor::MORE_INPUT;
+    size_t got = 0, at = 0;
+    while (status != Decompressor::FINISHED && status != Decompressor::FAILED) {
+        if (status == Decompressor::MORE_INPUT && at == got) {
+            got = fread(&chunk[0], 1, chunk.size(), stdin);
+            at = 0;
+            if (got == 0)
+                break;  // the input ended first
+        }
+        size_t consumed, produced;
+        status = decompressor.decode(&chunk[at], got - at, consumed,
+                                     &decoded[0], decoded.size(), produced);
+        at += consumed;
+        cout.write(&decoded[0], produced);
+    }
+    cout.flush();
+    if (status != Decompressor::FINISHED) {
+        cerr << "The compressed input is damaged or incomplete" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// statsCommand
+// Runs "program.exe stats [-j threads] [-b blockSize] [-o out.json] file",
+// which compresses file, decompresses the result again, and prints the
+// sizes and stage times of both as JSON, or writes them to out.json.
+// Returns 1 if either step failed.
+//
+int statsCommand(int argc, char** argv) {
+    CompressOptions options;
+    string filename, jsonFile;
+    for (int i = 0; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "-b" && i + 1 < argc) {
+            options.blockSize = strtoull(argv[++i], NULL, 10);
+        } else if (arg == "-o" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else {
+            filename = arg;
+        }
+    }
+    if (filename.empty()) {
+        cerr << "usage: program.exe stats [-j threads] [-b blockSize] [-o out.json] file"
+             << endl;
+        return 1;
+    }
+    bool ok;
+    if (jsonFile.empty()) {
+        ok = printCodingStats(cout, filename, options);
+    } else {
+        ofstream json(jsonFile.c_str());
+        ok = printCodingStats(json, filename, options);
+    }
+    return ok ? 0 : 1;
+}
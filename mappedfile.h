@@ -0,0 +1,176 @@
+//
+// mappedfile.h
+// This class gives read-only access to the whole contents of a file as one
+// contiguous span of bytes.  Regular files are memory-mapped, so reading
+// them costs one pass over the page cache and no copies.  Anything that
+// cannot be mapped (pipes, character devices, empty files, or platforms
+// without mmap) is read into a buffer instead, so callers never need to
+// know which one they got.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <fstream>
+#include <stddef.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MAPPEDFILE_HAS_MMAP 1
+#endif
+
+using namespace std;
+
+class mappedfile {
+public:
+    //
+    // default constructor:
+    //
+    // Creates a mappedfile that is not attached to any file.
+    //
+    mappedfile() : start(nullptr), length(0), mapped(false), opened(false) {}
+
+    //
+    // Opens filename right away; check is_open() for the result.
+    //
+    explicit mappedfile(const string &filename)
+        : start(nullptr), length(0), mapped(false), opened(false) {
+        open(filename);
+    }
+
+    ~mappedfile() {
+        close();
+    }
+
+    //
+    // open:
+    //
+    // Maps filename if it is a regular, non-empty file and tells the kernel
+    // we will read it front to back.  Otherwise reads it to the end into an
+    // internal buffer.  Returns false if the file cannot be opened.
+    //
+    bool open(const string &filename) {
+        close();
+#ifdef MAPPEDFILE_HAS_MMAP
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ,
+                              MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+                start = (const unsigned char*)addr;
+                length = (size_t)st.st_size;
+                mapped = true;
+            }
+        }
+        if (!mapped) {
+            // not mappable: read whatever the descriptor gives us
+            char chunk[1 << 16];
+            ssize_t got;
+            while ((got = ::read(fd, chunk, sizeof(chunk))) > 0) {
+                buffer.insert(buffer.end(), chunk, chunk + got);
+            }
+            start = buffer.empty() ? nullptr : &buffer[0];
+            length = buffer.size();
+        }
+        ::close(fd);  // a mapping stays valid after its descriptor is closed
+#else
+        ifstream in(filename, ios::in | ios::binary);
+        if (!in.is_open()) {
+            return false;
+        }
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        start = buffer.empty() ? nullptr : (const unsigned char*)&buffer[0];
+        length = buffer.size();
+#endif
+        opened = true;
+        return true;
+    }
+
+    //
+    // close:
+    //
+    // Unmaps or frees the contents.  O(1) for mapped files.
+    //
+    void close() {
+#ifdef MAPPEDFILE_HAS_MMAP
+        if (mapped) {
+            munmap((void*)start, length);
+        }
+#endif
+        vector<unsigned char>().swap(buffer);
+        start = nullptr;
+        length = 0;
+        mapped = false;
+        opened = false;
+    }
+
+    //
+    // prefault:
+    //
+    // Reads every page of a mapped file in now rather than on first use,
+    // so that the time it takes to come off the disk can be measured apart
+    // from the work done on the bytes.  Files read into a buffer already
+    // are.  Costs one touch per page.
+    //
+    void prefault() const {
+#ifdef MAPPEDFILE_HAS_MMAP
+        if (!mapped)
+            return;
+        madvise((void*)start, length, MADV_WILLNEED);
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        unsigned char sum = 0;
+        for (size_t i = 0; i < length; i += page) {
+            sum += start[i];
+        }
+        volatile unsigned char sink = sum;  // keeps the loop from being dropped
+        (void)sink;
+#endif
+    }
+
+    bool is_open() const { return opened; }
+    const unsigned char* data() const { return start; }
+    const unsigned char* end() const { return start + length; }
+    size_t size() const { return length; }
+
+private:
+    mappedfile(const mappedfile &);  // not copyable
+    mappedfile& operator=(const mappedfile &);
+
+    const unsigned char* start;
+    size_t length;
+    bool mapped;
+    bool opened;
+    vector<unsigned char> buffer;
+};
+
+//
+// spanbuf
+// A read-only streambuf over a span of memory, so code written against
+// istream (like hashmap's >> operator) can parse straight out of a
+// mappedfile.  Only tellg-style queries are supported for seeking.
+//
+class spanbuf : public streambuf {
+public:
+    spanbuf(const unsigned char* begin, size_t length) {
+        char* p = (char*)begin;
+        setg(p, p, p + length);
+    }
+
+protected:
+    pos_type seekoff(off_type off, ios_base::seekdir dir,
+                     ios_base::openmode which = ios_base::in) {
+        if (dir != ios_base::cur || off != 0 || !(which & ios_base::in)) {
+            return pos_type(off_type(-1));
+        }
+        return pos_type(off_type(gptr() - eback()));
+    }
+};
@@ -0,0 +1,351 @@
+//
+// microbench.cpp
+// Microbenchmarks for the classes the compressor is built on, each on its
+// own: hashmap put/get/containsKey at several key counts, priorityqueue
+// enqueue/dequeue with distinct and with heavily duplicated priorities,
+// and the bit streams one bit at a time (ibitstream::readBit,
+// obitstream::writeBit) next to their bulk alternatives, and encodeSymbols
+// with each encode kernel the CPU has, whose output is also checked to be
+// the same bytes as the scalar kernel's.  Every case runs
+// --warmup untimed rounds and then --reps timed ones; the table shows the
+// median, 10th and 90th percentile and worst time per operation, so noise
+// shows up as spread instead of hiding in an average.  The same numbers
+// go to --json (microbench.json by default).
+//
+// Usage: microbench.exe [--reps 21] [--warmup 3] [--filter hashmap]
+//                       [--json microbench.json]
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <stdint.h>
+#include "util.h"
+#include "priorityqueue.h"
+
+using namespace std;
+
+struct CaseResult {
+    string name;
+    size_t ops;        // operations per round
+    double median;     // nanoseconds per operation
+    double p10;
+    double p90;
+    double max;
+};
+
+//
+// Settings and results shared by all cases.
+//
+struct MicroBench {
+    int reps;
+    int warmup;
+    string filter;
+    vector<CaseResult> results;
+    vector<string> mismatches;  // kernels whose output differed
+    // keeps results the compiler would otherwise drop as unused
+    uint64_t sink;
+    MicroBench() : reps(21), warmup(3), sink(0) {}
+};
+
+//
+// Returns the value below which a fraction q of the sorted times fall.
+//
+double percentile(const vector<double> &sorted, double q) {
+    double at = q * (sorted.size() - 1);
+    size_t i = (size_t)at;
+    if (i + 1 >= sorted.size())
+        return sorted.back();
+    return sorted[i] + (at - i) * (sorted[i + 1] - sorted[i]);
+}
+
+//
+// Times one case.  Each round calls setup, untimed, and then round, which
+// does ops operations.  Cases whose name does not contain the filter are
+// skipped.
+//
+void runCase(MicroBench &bench, const string &name, size_t ops,
+             function<void()> setup, function<void()> round) {
+    if (name.find(bench.filter) == string::npos)
+        return;
+    vector<double> times;
+    for (int r = 0; r < bench.warmup + bench.reps; r++) {
+        setup();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        round();
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        if (r >= bench.warmup)
+            times.push_back(ns / ops);
+    }
+    sort(times.begin(), times.end());
+    CaseResult result = {name, ops, percentile(times, 0.5), percentile(times, 0.1),
+                         percentile(times, 0.9), times.back()};
+    bench.results.push_back(result);
+    cout << left << setw(40) << name << right << fixed << setprecision(2)
+         << setw(10) << result.median << setw(10) << result.p10
+         << setw(10) << result.p90 << setw(10) << result.max << endl;
+}
+
+//
+// Returns n pseudo-random keys, distinct with high probability.
+//
+vector<int> randomKeys(size_t n, uint32_t seed) {
+    vector<int> keys(n);
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        keys[i] = (int)(x & 0x7FFFFFFF);
+    }
+    return keys;
+}
+
+void benchHashmap(MicroBench &bench) {
+    const size_t counts[] = {256, 4096, 65536, 1 << 20};
+    for (size_t c = 0; c < 4; c++) {
+        size_t n = counts[c];
+        vector<int> keys = randomKeys(n, 1);
+        vector<int> misses = randomKeys(n, 2);
+        ostringstream suffix;
+        suffix << " n=" << n;
+        hashmap<int, int> map;
+        runCase(bench, "hashmap::put" + suffix.str(), n,
+                [&] { map = hashmap<int, int>(); },
+                [&] {
+                    for (size_t i = 0; i < n; i++) {
+                        map.put(keys[i], (int)i);
+                    }
+                });
+        runCase(bench, "hashmap::get" + suffix.str(), n, [] {},
+                [&] {
+                    uint64_t sum = 0;
+                    for (size_t i = 0; i < n; i++) {
+                        sum += map.get(keys[i]);
+                    }
+                    bench.sink += sum;
+                });
+        runCase(bench, "hashmap::containsKey 50% hits" + suffix.str(), n, [] {},
+                [&] {
+                    uint64_t found = 0;
+                    for (size_t i = 0; i < n; i++) {
+                        found += map.containsKey((i & 1) ? keys[i] : misses[i]);
+                    }
+                    bench.sink += found;
+                });
+    }
+}
+
+void benchPriorityqueue(MicroBench &bench) {
+    // distinct priorities, and 16 priorities shared by all elements
+    const size_t n = 4096;
+    vector<int> distinct = randomKeys(n, 3);
+    vector<int> duplicated(n);
+    for (size_t i = 0; i < n; i++) {
+        duplicated[i] = distinct[i] % 16;
+    }
+    const vector<int>* cases[] = {&distinct, &duplicated};
+    const char* names[] = {" distinct", " 16 priorities"};
+    for (int c = 0; c < 2; c++) {
+        const vector<int> &priorities = *cases[c];
+        priorityqueue<int> pq;
+        runCase(bench, string("priorityqueue::enqueue") + names[c], n,
+                [&] { pq.clear(); },
+                [&] {
+                    for (size_t i = 0; i < n; i++) {
+                        pq.enqueue((int)i, priorities[i]);
+                    }
+                });
+        runCase(bench, string("priorityqueue::dequeue") + names[c], n,
+                [&] {
+                    pq.clear();
+                    for (size_t i = 0; i < n; i++) {
+                        pq.enqueue((int)i, priorities[i]);
+                    }
+                },
+                [&] {
+                    uint64_t sum = 0;
+                    for (size_t i = 0; i < n; i++) {
+                        sum += pq.dequeue();
+                    }
+                    bench.sink += sum;
+                });
+    }
+}
+
+void benchBitstream(MicroBench &bench) {
+    const size_t nBytes = 1 << 15;
+    const size_t nBits = 8 * nBytes;
+    string data;
+    vector<int> r = randomKeys(nBytes, 4);
+    for (size_t i = 0; i < nBytes; i++) {
+        data += (char)r[i];
+    }
+    // writing: one bit per call, a byte per call, and the bare bit writer
+    unique_ptr<ostringbitstream> out;
+    runCase(bench, "obitstream::writeBit", nBits,
+            [&] { out.reset(new ostringbitstream()); },
+            [&] {
+                for (size_t i = 0; i < nBits; i++) {
+                    out->writeBit((data[i / 8] >> (i % 8)) & 1);
+                }
+                bench.sink += out->str().size();
+            });
+    runCase(bench, "obitstream::writeBits(8) per bit", nBits,
+            [&] { out.reset(new ostringbitstream()); },
+            [&] {
+                for (size_t i = 0; i < nBytes; i++) {
+                    out->writeBits((unsigned char)data[i], 8);
+                }
+                bench.sink += out->str().size();
+            });
+    bitwriter writer;
+    runCase(bench, "bitwriter::writeBits(8) per bit", nBits,
+            [&] { writer.reset(); },
+            [&] {
+                for (size_t i = 0; i < nBytes; i++) {
+                    writer.writeBits((unsigned char)data[i], 8);
+                }
+                writer.finish();
+                bench.sink += writer.size();
+            });
+    // reading, the same three ways
+    unique_ptr<istringbitstream> in;
+    runCase(bench, "ibitstream::readBit", nBits,
+            [&] { in.reset(new istringbitstream(data)); },
+            [&] {
+                uint64_t ones = 0;
+                for (size_t i = 0; i < nBits; i++) {
+                    ones += in->readBit();
+                }
+                bench.sink += ones;
+            });
+    runCase(bench, "ibitstream::readBits(8) per bit", nBits,
+            [&] { in.reset(new istringbitstream(data)); },
+            [&] {
+                uint64_t sum = 0;
+                for (size_t i = 0; i < nBytes; i++) {
+                    sum += in->readBits(8);
+                }
+                bench.sink += sum;
+            });
+    bitreader reader;
+    runCase(bench, "bitreader::readBits(8) per bit", nBits,
+            [&] {
+                reader.setSpan((const unsigned char*)data.data(),
+                               (const unsigned char*)data.data() + data.size());
+            },
+            [&] {
+                uint64_t sum = 0;
+                for (size_t i = 0; i < nBytes; i++) {
+                    sum += reader.readBits(8);
+                }
+                bench.sink += sum;
+            });
+}
+
+void benchEncodeKernels(MicroBench &bench) {
+    // skewed bytes, so that the codes have many different lengths
+    const size_t n = 1 << 16;
+    vector<int> r = randomKeys(n, 5);
+    vector<unsigned char> data(n);
+    for (size_t i = 0; i < n; i++) {
+        int run = __builtin_ctz((unsigned)r[i] | 0x100);  // 0 half the time
+        data[i] = (unsigned char)(run * 16 + (r[i] >> 20 & 15));
+    }
+    uint64_t counts[PSEUDO_EOF + 1] = {};
+    byteHistogram(&data[0], n, counts);
+    HuffmanCode codes[PSEUDO_EOF + 1];
+    buildCodes(counts, codes, KERNEL_MAX_CODE_LENGTH);
+    const EncodeKernel kernels[] = {KERNEL_SCALAR, KERNEL_SSE4, KERNEL_AVX2};
+    const char* names[] = {"scalar", "sse4.1", "avx2"};
+    string reference;
+    bitwriter writer;
+    for (int k = 0; k < 3; k++) {
+        setEncodeKernel(kernels[k]);
+        if (activeEncodeKernel() != kernels[k])
+            continue;  // not on this CPU
+        writer.reset();
+        encodeSymbols(&data[0], n, codes, writer);
+        writer.finish();
+        string out((const char*)writer.data(), writer.size());
+        if (k == 0)
+            reference = out;
+        else if (out != reference)
+            bench.mismatches.push_back(names[k]);
+        runCase(bench, string("encodeSymbols ") + names[k], n,
+                [&] { writer.reset(); },
+                [&] {
+                    encodeSymbols(&data[0], n, codes, writer);
+                    writer.finish();
+                    bench.sink += writer.size();
+                });
+    }
+    setEncodeKernel(KERNEL_AUTO);
+}
+
+//
+// Writes the results as JSON.
+//
+void writeJson(ostream &out, const MicroBench &bench) {
+    out << "{\n  \"reps\": " << bench.reps << ",\n  \"warmup\": " << bench.warmup
+        << ",\n  \"unit\": \"ns/op\",\n  \"results\": [\n";
+    for (size_t i = 0; i < bench.results.size(); i++) {
+        const CaseResult &r = bench.results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+            << ", \"median\": " << r.median << ", \"p10\": " << r.p10
+            << ", \"p90\": " << r.p90 << ", \"max\": " << r.max << "}"
+            << (i + 1 < bench.results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+//
+// Prints how to run the microbenchmarks and returns the exit code for a
+// bad command line.
+//
+int usage() {
+    cerr << "usage: microbench.exe [--reps 21] [--warmup 3] [--filter hashmap]\n"
+            "                      [--json microbench.json]" << endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    MicroBench bench;
+    string jsonFile = "microbench.json";
+    for (int i = 1; i < argc; i += 2) {
+        string arg = argv[i];
+        if (i + 1 == argc)
+            return usage();  // every flag takes a value
+        if (arg == "--reps")
+            bench.reps = max(1, atoi(argv[i + 1]));
+        else if (arg == "--warmup")
+            bench.warmup = max(0, atoi(argv[i + 1]));
+        else if (arg == "--filter")
+            bench.filter = argv[i + 1];
+        else if (arg == "--json")
+            jsonFile = argv[i + 1];
+        else
+            return usage();
+    }
+    cout << left << setw(40) << "ns per operation" << right << setw(10) << "median"
+         << setw(10) << "p10" << setw(10) << "p90" << setw(10) << "max" << endl;
+    benchHashmap(bench);
+    benchPriorityqueue(bench);
+    benchBitstream(bench);
+    benchEncodeKernels(bench);
+    ofstream json(jsonFile.c_str());
+    writeJson(json, bench);
+    cout << "Wrote " << jsonFile << " (checksum " << bench.sink % 1000 << ")" << endl;
+    for (size_t i = 0; i < bench.mismatches.size(); i++) {
+        cerr << "The " << bench.mismatches[i]
+             << " encode kernel wrote other bytes than the scalar one" << endl;
+    }
+    return bench.mismatches.empty() ? 0 : 1;
+}
@@ -249,7 +249,7 @@ public:
     // duplicate priorities
     //
     T dequeue() {
-        T valueOut;
+        T valueOut = T();
         NODE* originalCurr = curr;
         begin();
         NODE* tmp = curr;
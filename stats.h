@@ -0,0 +1,126 @@
+//
+// stats.h
+// Counters and stage timings of one compress or decompress.  Stages are
+// timed with the monotonic steady_clock, once per block rather than per
+// symbol, so collecting them costs nothing measurable; nothing is timed
+// at all unless a CodingStats is passed in.  To keep disk time out of
+// the coding stages, a mapped input is then paged in during the read
+// stage instead of as it is first touched.  With several threads the
+// stage times are summed over the threads, so they can add up to more
+// than totalSeconds, which is wall-clock time.
+//
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+struct CodingStats {
+    uint64_t bytesIn;       // bytes read, compressed or not
+    uint64_t bytesOut;      // bytes written
+    uint64_t symbols;       // bytes coded or decoded
+    uint64_t codedBits;     // bits of code; when decoding, with padding
+    uint64_t headerBytes;   // bytes of headers, code tables and index
+    uint64_t blocks;
+    double readSeconds;     // opening, mapping and paging in the input
+    double countSeconds;    // byte histograms
+    double codeSeconds;     // code lengths and codes, or decoding tables
+    double encodeSeconds;
+    double decodeSeconds;
+    double writeSeconds;    // writing the output
+    double totalSeconds;
+
+    CodingStats()
+        : bytesIn(0), bytesOut(0), symbols(0), codedBits(0), headerBytes(0),
+          blocks(0), readSeconds(0), countSeconds(0), codeSeconds(0),
+          encodeSeconds(0), decodeSeconds(0), writeSeconds(0), totalSeconds(0) {}
+
+    //
+    // Adds the counters and stage times of other to these; the total time
+    // is left alone.
+    //
+    void add(const CodingStats &other) {
+        bytesIn += other.bytesIn;
+        bytesOut += other.bytesOut;
+        symbols += other.symbols;
+        codedBits += other.codedBits;
+        headerBytes += other.headerBytes;
+        blocks += other.blocks;
+        readSeconds += other.readSeconds;
+        countSeconds += other.countSeconds;
+        codeSeconds += other.codeSeconds;
+        encodeSeconds += other.encodeSeconds;
+        decodeSeconds += other.decodeSeconds;
+        writeSeconds += other.writeSeconds;
+    }
+
+    double averageCodeLength() const {
+        return symbols ? (double)codedBits / symbols : 0;
+    }
+
+    //
+    // Writes the stats as one JSON object.
+    //
+    void writeJson(ostream &out) const {
+        out << "{\"bytesIn\": " << bytesIn << ", \"bytesOut\": " << bytesOut
+            << ", \"symbols\": " << symbols << ", \"codedBits\": " << codedBits
+            << ", \"averageCodeLength\": " << averageCodeLength()
+            << ", \"headerBytes\": " << headerBytes << ", \"blocks\": " << blocks
+            << ", \"seconds\": {\"read\": " << readSeconds
+            << ", \"count\": " << countSeconds << ", \"code\": " << codeSeconds
+            << ", \"encode\": " << encodeSeconds << ", \"decode\": " << decodeSeconds
+            << ", \"write\": " << writeSeconds << ", \"total\": " << totalSeconds
+            << "}}";
+    }
+};
+
+//
+// Writes text to out as a JSON string, quoted, with quotes, backslashes
+// and control characters escaped.
+//
+inline void writeJsonString(ostream &out, const string &text) {
+    static const char* hex = "0123456789abcdef";
+    out << '"';
+    for (size_t i = 0; i < text.length(); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\')
+            out << '\\' << (char)c;
+        else if (c == '\n')
+            out << "\\n";
+        else if (c == '\t')
+            out << "\\t";
+        else if (c < 0x20)
+            out << "\\u00" << hex[c >> 4] << hex[c & 15];
+        else
+            out << (char)c;
+    }
+    out << '"';
+}
+
+//
+// A stopwatch for adding up the time of stages: lap adds the time since
+// the last lap, or since the timer was made, to one of the stage times of
+// stats, e.g. lap(&CodingStats::encodeSeconds).  If stats is null it does
+// nothing, so the laps can stay in place when no stats are wanted.
+//
+class stagetimer {
+public:
+    explicit stagetimer(CodingStats* stats)
+        : stats(stats), last(stats ? chrono::steady_clock::now()
+                                   : chrono::steady_clock::time_point()) {}
+
+    void lap(double CodingStats::*stage) {
+        if (stats == nullptr)
+            return;
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        stats->*stage += chrono::duration<double>(now - last).count();
+        last = now;
+    }
+
+private:
+    CodingStats* stats;
+    chrono::steady_clock::time_point last;
+};
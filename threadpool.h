@@ -0,0 +1,151 @@
+//
+// threadpool.h
+// A fixed set of worker threads that run submitted tasks.  Every worker has
+// a queue of its own: submitted tasks are dealt out to the queues in turn,
+// and every worker takes tasks from its own queue, and steals them from
+// another queue once its own is empty, oldest first.  So tasks start in
+// about the order they were submitted, which keeps a caller that waits on
+// them in order from stalling; one slow task only holds up its own worker
+// while the others drain the rest; and workers rarely touch the same lock.
+// Idle workers sleep until a task is submitted.
+//
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using namespace std;
+
+class threadpool {
+public:
+    //
+    // constructor:
+    //
+    // Starts nThreads workers, or one per hardware thread if nThreads is 0.
+    //
+    explicit threadpool(int nThreads = 0) : pending(0), nextQueue(0), stopping(false) {
+        if (nThreads <= 0)
+            nThreads = defaultThreads();
+        for (int i = 0; i < nThreads; i++) {
+            queues.push_back(unique_ptr<taskqueue>(new taskqueue()));
+        }
+        for (int i = 0; i < nThreads; i++) {
+            workers.push_back(thread(&threadpool::run, this, i));
+        }
+    }
+
+    //
+    // destructor:
+    //
+    // Runs every task still queued, then stops the workers.
+    //
+    ~threadpool() {
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    //
+    // submit:
+    //
+    // Queues task to run on some worker.  Tasks may submit further tasks.
+    //
+    void submit(function<void()> task) {
+        size_t q = nextQueue++ % queues.size();
+        {
+            lock_guard<mutex> guard(queues[q]->lock);
+            queues[q]->tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> guard(sleepLock);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    int size() const { return (int)workers.size(); }
+
+    //
+    // Returns the number of hardware threads, or 1 if it is unknown.
+    //
+    static int defaultThreads() {
+        unsigned n = thread::hardware_concurrency();
+        return n == 0 ? 1 : (int)n;
+    }
+
+private:
+    struct taskqueue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    threadpool(const threadpool&);
+    threadpool& operator=(const threadpool&);
+
+    //
+    // Takes the oldest task of queue self or, failing that, the oldest task
+    // of another queue.  Returns false if every queue is empty.
+    //
+    bool take(size_t self, function<void()> &task) {
+        {
+            lock_guard<mutex> guard(queues[self]->lock);
+            if (!queues[self]->tasks.empty()) {
+                task = move(queues[self]->tasks.front());
+                queues[self]->tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            taskqueue &victim = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //
+    // The loop of worker self.  pending counts the tasks queued but not yet
+    // taken, so a worker only sleeps when there is nothing left to steal.
+    //
+    void run(size_t self) {
+        function<void()> task;
+        while (true) {
+            {
+                unique_lock<mutex> guard(sleepLock);
+                wake.wait(guard, [this] { return pending > 0 || stopping; });
+                if (pending == 0)
+                    return;  // stopping, and nothing left to run
+                pending--;
+            }
+            // a task is reserved for us, though maybe in another queue
+            while (!take(self, task)) {
+                this_thread::yield();
+            }
+            task();
+            task = nullptr;
+        }
+    }
+
+    vector<unique_ptr<taskqueue>> queues;
+    vector<thread> workers;
+    mutex sleepLock;
+    condition_variable wake;
+    size_t pending;
+    atomic<size_t> nextQueue;
+    bool stopping;
+};
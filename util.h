@@ -8,267 +8,1041 @@
 
 #pragma once
 
+#include <iostream>
 #include <queue>
+#include <iterator>
+#include <sstream>
 #include "hashmap.h"
 #include "bitstream.h"
+#include "mappedfile.h"
+#include "encodekernel.h"
+#include "decodetable.h"
+#include "container.h"
+#include "histogram.h"
+#include "codelengths.h"
+#include "huffmantree.h"
+#include "threadpool.h"
+#include "stats.h"
 
-typedef hashmap hashmapF;
-typedef unordered_map <int, string> hashmapE;
+typedef hashmap<int, int> hashmapF;
 
-struct HuffmanNode {
-    int character;
-    int count;
-    int order;
-    HuffmanNode* zero;
-    HuffmanNode* one;
+// The encoding map: the code of every symbol in a dense table indexed by
+// (unsigned char) value, with PSEUDO_EOF at index 256, so looking a code up
+// is one array access.  A length of 0 means the symbol has no code.
+struct EncodingTable {
+    HuffmanCode codes[PSEUDO_EOF + 1];
+    EncodingTable() {
+        for (int i = 0; i <= PSEUDO_EOF; i++) {
+            codes[i].bits = 0;
+            codes[i].length = 0;
+        }
+    }
+    const HuffmanCode& operator[](int symbol) const { return codes[symbol]; }
+};
+
+// Settings for compress.  The defaults give plain Huffman coding in 1 MiB
+// blocks.
+struct CompressOptions {
+    // longest code allowed, 0 for no limit (see codelengths.h)
+    int maxCodeLength;
+    // bytes per block, from MIN_BLOCK_SIZE to MAX_BLOCK_SIZE (container.h);
+    // larger blocks share one code table over more data, smaller ones
+    // follow changes in the data more closely
+    uint64_t blockSize;
+    // threads that code blocks, 0 for one per hardware thread; the output
+    // is the same for any number
+    int threads;
+    // code every block as INTERLEAVED_STREAMS streams, which decode faster
+    bool interleaved;
+    CompressOptions()
+        : maxCodeLength(0), blockSize(1 << 20), threads(0), interleaved(true) {}
 };
 
-// This class is used for ordering elements in the priority quueue
+// This class is used for ordering elements in the priority quueue.  The
+// elements are (node index, count) pairs; node indices follow the order the
+// nodes were made in.
 class prioritize {
-    public: bool operator() (const pair<HuffmanNode*, int> &p1,
-    const pair<HuffmanNode*, int> &p2) const {
+    public: bool operator() (const pair<uint16_t, int> &p1,
+    const pair<uint16_t, int> &p2) const {
         // if they have the same count its ordered by order of insert.
         if (p1.second == p2.second)
-            return p1.first->order > p2.first->order;
+            return p1.first > p2.first;
         else
             return p1.second > p2.second;  
     }
 };
 
-// This function takes the order, count, and character and allocates
-// memory for a new node and returns it.
-HuffmanNode* makeNode(int character, int count, int order) {
-    HuffmanNode* node = new HuffmanNode;
-    node->character = character;
-    node->count = count;
-    node->order = order;
-    node->zero = node->one = nullptr;
-    return node;
+//
+// This function adds the byte counts of a histogram to map, keyed the way
+// chars are stored: as (int)(char) values.  Bytes that do not occur are
+// left out.
+//
+void exportHistogram(const uint64_t counts[256], hashmapF &map) {
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] == 0)
+            continue;
+        map.increment((int)(char)i, (int)counts[i]);
+    }
 }
 
 //
-// This method frees the memory allocated for the Huffman tree
-// by traversing through each node and deleting it.
+// Helper function for building the frequency map.  Counts every char of the
+// length chars starting at data with the histogram kernel, then adds the
+// counts to map.
 //
-void freeTree(HuffmanNode* node) {
-    if (node == nullptr)
-            return;
-    freeTree(node->zero);
-    freeTree(node->one);
-    delete node;
+void _buildFrequencyMap(const char* data, size_t length, hashmapF &map) {
+    uint64_t counts[256] = {};
+    byteHistogram((const unsigned char*)data, length, counts);
+    exportHistogram(counts, map);
+    map.put(PSEUDO_EOF, 1);  // 1 EOF added in the end
 }
 
 //
 // This function build the frequency map.  If isFile is true, then it reads
 // from filename.  If isFile is false, then it reads from a string filename.
-//
+// Files are memory-mapped and counted in place rather than read a char at
+// a time.
 //
 void buildFrequencyMap(string filename, bool isFile, hashmapF &map) {
-    int value = 0;
     if (isFile) {
-        ifbitstream file(filename);
-        char letter;
-        while (file >> noskipws >> letter) {
-            if (map.containsKey(letter)) {  // if char already in map
-                value = map.get(letter);
-                map.put((int)letter, value + 1);  // increments count by 1
-            } else {
-                map.put((int)letter, 1);
-            }
-        }
-        map.put(PSEUDO_EOF, 1);  // 1 EOF added in the end
-        file.close();
+        mappedfile file(filename);
+        _buildFrequencyMap((const char*)file.data(), file.size(), map);
     } else {  // filename is a string
-        size_t i;
-        for (i = 0; i < filename.length(); i++) {
-            if (map.containsKey(filename[i])) {  // if char already in map
-                value = map.get(filename[i]);
-                map.put((int)filename[i], value + 1);  // adds 1 to curr count
-            } else {
-                map.put((int)filename[i], 1);
-            }
-        }
-        map.put(PSEUDO_EOF, 1);  // 1 EOF added in the end
+        _buildFrequencyMap(filename.data(), filename.length(), map);
     }
 }
 
 //
-// This function builds an encoding tree from the frequency map.
+// This function builds a Huffman tree from (character, count) pairs with a
+// priority queue, breaking ties between equal counts by the order of the
+// pairs.  That is how the codes of files with the old text header were
+// made, so it is only used to read those files.  The tree is left empty if
+// there are more pairs than symbols.
 //
-HuffmanNode* buildEncodingTree(hashmapF &map) {
+void _buildLegacyTree(const vector<pair<int, int>> &counts, HuffmanTree &tree) {
+    tree.clear();
+    if (counts.size() > PSEUDO_EOF + 1)  // more symbols than there are
+        return;
     priority_queue <
-    pair<HuffmanNode*, int>,
-    vector<pair<HuffmanNode*, int>>,
+    pair<uint16_t, int>,
+    vector<pair<uint16_t, int>>,
     prioritize> pq;
-    int order = 0;
-    // loops through the map and makes nodes for character and its count.
+    // loops through the pairs and makes nodes for character and its count.
     // then adds the nodes to the priority queue
-    for (auto &character : map.keys()) {
-        int count = map.get(character);
-        HuffmanNode* node = makeNode(character, count, order);
-        pq.push(pair<HuffmanNode*, int>(node, count));
-        order++;
+    for (auto &entry : counts) {
+        uint16_t node = tree.makeNode(entry.first, entry.second);
+        pq.push(pair<uint16_t, int>(node, entry.second));
     }
-    HuffmanNode* root = nullptr;
     // Takes the first two nodes, makes a new node as their parent with
     // their combined counts. Keeps doing this until theirs only one node
     // in the queue which means we have a tree.
-    while (pq.size() != 1) {
-        pair<HuffmanNode*, int> pairOne = pq.top();
+    while (pq.size() > 1) {
+        pair<uint16_t, int> pairOne = pq.top();
         pq.pop();
-        pair<HuffmanNode*, int> pairTwo = pq.top();
+        pair<uint16_t, int> pairTwo = pq.top();
         pq.pop();
-        root = makeNode(NOT_A_CHAR, pairOne.second + pairTwo.second, order);
-        root->zero = pairOne.first;
-        root->one = pairTwo.first;
-        pq.push(make_pair(root, pairOne.second + pairTwo.second));
-        order++;
+        uint16_t parent = tree.makeNode(NOT_A_CHAR, pairOne.second + pairTwo.second);
+        tree[parent].zero = pairOne.first;
+        tree[parent].one = pairTwo.first;
+        pq.push(make_pair(parent, pairOne.second + pairTwo.second));
     }
-    return root;
+    if (!pq.empty())  // the last node is the root, or a single symbol
+        tree.setRoot(pq.top().first);
+}
+
+//
+// This function copies the counts of a frequency map into an array indexed
+// by (unsigned char) value, with PSEUDO_EOF at index 256.
+//
+void _countsFromMap(hashmapF &map, uint64_t counts[PSEUDO_EOF + 1]) {
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        counts[i] = 0;
+    }
+    for (auto &e : map) {
+        int index = (e.key == PSEUDO_EOF) ? PSEUDO_EOF : (unsigned char)e.key;
+        counts[index] += (uint64_t)e.value;
+    }
+}
+
+//
+// Reverses the low length bits of code.
+//
+uint64_t _reverseBits(uint64_t code, int length) {
+    uint64_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    return reversed;
+}
+
+//
+// This function assigns canonical Huffman codes from the code lengths in
+// codes: shorter codes come first, and codes of the same length are
+// consecutive numbers in symbol order.  So the lengths alone determine
+// every code, whatever tree they came from.  The codes are packed first bit
+// lowest, like every other code table.  Lengths must be at most 64.
+//
+void buildCanonicalCodes(HuffmanCode codes[PSEUDO_EOF + 1]) {
+    int lengthCount[65] = {};
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        lengthCount[codes[i].length]++;
+    }
+    lengthCount[0] = 0;
+    uint64_t nextCode[65] = {};
+    uint64_t code = 0;
+    for (int length = 1; length <= 64; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        int length = codes[i].length;
+        codes[i].bits = length ? _reverseBits(nextCode[length]++, length) : 0;
+    }
+}
+
+//
+// This function builds the codes for the given counts: Huffman code
+// lengths without a tree (see codelengths.h), then the canonical codes for
+// those lengths.  If maxCodeLength is not 0, the lengths are limited to it.
+//
+void buildCodes(const uint64_t counts[PSEUDO_EOF + 1],
+                HuffmanCode codes[PSEUDO_EOF + 1], int maxCodeLength = 0) {
+    buildCodeLengths(counts, codes, maxCodeLength);
+    buildCanonicalCodes(codes);
+}
+
+//
+// This function returns how many bits the counted symbols take with codes.
+//
+uint64_t encodedBits(const uint64_t counts[PSEUDO_EOF + 1],
+                     const HuffmanCode codes[PSEUDO_EOF + 1]) {
+    uint64_t bits = 0;
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        bits += counts[i] * (uint64_t)codes[i].length;
+    }
+    return bits;
+}
+
+//
+// This function sets codes to the code lengths of a version 2 block: the
+// chars starting at data, at least one, whose bytes were counted into
+// counts.  The bits are left for buildCanonicalCodes.
+//
+void _blockCodeLengths(const char* data, const uint64_t counts[PSEUDO_EOF + 1],
+                       int maxCodeLength, HuffmanCode codes[PSEUDO_EOF + 1]) {
+    buildCodeLengths(counts, codes, maxCodeLength);
+    // a block of one repeated byte has no PSEUDO_EOF to share the code
+    // with, but its byte still needs a bit to be counted by
+    HuffmanCode &first = codes[(unsigned char)data[0]];
+    if (first.length == 0)
+        first.length = 1;
 }
 
 //
-// Recursive helper function for building the encoding map.
+// This function returns how much larger compress makes the size chars at
+// data when code lengths are limited to options.maxCodeLength, as a
+// fraction of their size with unlimited Huffman codes (0.01 means 1%
+// larger).  Like compress, it codes them in blocks of options.blockSize,
+// each with its own code; only the code bits are counted.  A block with
+// more distinct bytes than codes of maxCodeLength bits can tell apart gets
+// longer codes, so limit is set to the longest length any block was
+// allowed, or 0 if the lengths are not limited.
 //
-void _buildEncodingMap(HuffmanNode* node, hashmapE &encodingMap, string str) {
-    if (!node->zero && !node->one) {  // if leaf node
-        // insert char and its encoding
-        encodingMap.insert({(int)node->character, str});
+double lengthLimitCost(const char* data, size_t size, const CompressOptions &options,
+                       int &limit) {
+    uint64_t blockSize = min(max(options.blockSize, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+    uint64_t best = 0, limited = 0;
+    limit = max(options.maxCodeLength, 0);
+    for (size_t start = 0; start < size; start += (size_t)blockSize) {
+        size_t length = (size_t)min((uint64_t)(size - start), blockSize);
+        uint64_t counts[PSEUDO_EOF + 1] = {};
+        byteHistogram((const unsigned char*)data + start, length, counts);
+        HuffmanCode unlimitedCodes[PSEUDO_EOF + 1], limitedCodes[PSEUDO_EOF + 1];
+        _blockCodeLengths(data + start, counts, 0, unlimitedCodes);
+        _blockCodeLengths(data + start, counts, options.maxCodeLength, limitedCodes);
+        best += encodedBits(counts, unlimitedCodes);
+        limited += encodedBits(counts, limitedCodes);
+        if (options.maxCodeLength > 0) {
+            int n = 0;
+            for (int i = 0; i <= PSEUDO_EOF; i++) {
+                n += counts[i] != 0;
+            }
+            limit = max(limit, codeLengthLimit(options.maxCodeLength, n));
+        }
+    }
+    if (best == 0)
+        return 0;
+    return (double)(limited - best) / (double)best;
+}
+
+//
+// This function builds the tree that spells out codes, for viewing it: the
+// path to each leaf follows its code bits, 0 to zero and 1 to one.  Leaves
+// carry their counts and internal nodes the sums below them.  If no symbol
+// has a bit of code, the tree is the leaf of the only counted symbol.
+//
+void _buildTreeFromCodes(const HuffmanCode codes[PSEUDO_EOF + 1],
+                         const uint64_t counts[PSEUDO_EOF + 1],
+                         HuffmanTree &tree) {
+    tree.clear();
+    uint16_t root = tree.makeNode(NOT_A_CHAR, 0);
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        if (codes[i].length == 0)
+            continue;
+        int count = (int)counts[i];
+        uint16_t node = root;
+        for (int bit = 0; bit < codes[i].length && node != HuffmanTree::NO_NODE; bit++) {
+            tree[node].count += count;
+            uint16_t &child = ((codes[i].bits >> bit) & 1) ? tree[node].one
+                                                            : tree[node].zero;
+            if (child == HuffmanTree::NO_NODE)
+                child = tree.makeNode(NOT_A_CHAR, 0);
+            node = child;
+        }
+        if (node == HuffmanTree::NO_NODE)  // not a prefix code; cannot happen
+            break;
+        tree[node].character = (i == PSEUDO_EOF) ? PSEUDO_EOF : (int)(char)i;
+        tree[node].count = count;
+    }
+    if (!tree.isLeaf(root)) {
+        tree.setRoot(root);
         return;
     }
-    if (node->zero) {
-        str += "0";  // adds zero if their is a left child
-        _buildEncodingMap(node->zero, encodingMap, str);
-        // after it comes back from its left child and moves on to the right
-        // child it doesn't need the 0 anymore in the string so we get rid of
-        // that here
-        str = str.substr(0, str.length() - 1);
+    tree.clear();  // at most one symbol
+    for (int i = 0; i <= PSEUDO_EOF; i++) {
+        if (counts[i] != 0) {
+            tree.setRoot(tree.makeNode((i == PSEUDO_EOF) ? PSEUDO_EOF : (int)(char)i,
+                                       (int)counts[i]));
+            break;
+        }
     }
-    if (node->one) {
-        str += "1";  // adds one if their is a right child
-        _buildEncodingMap(node->one, encodingMap, str);
+}
+
+//
+// This function builds an encoding tree from the frequency map.  The code
+// lengths are computed without a tree; this tree only spells out the
+// resulting canonical codes, for printTree and the interactive steps.
+//
+HuffmanTree buildEncodingTree(hashmapF &map) {
+    uint64_t counts[PSEUDO_EOF + 1];
+    HuffmanCode codes[PSEUDO_EOF + 1];
+    HuffmanTree tree;
+    _countsFromMap(map, counts);
+    buildCodes(counts, codes);
+    _buildTreeFromCodes(codes, counts, tree);
+    return tree;
+}
+
+//
+// Recursive helper function that records the depth of every leaf of the
+// tree as the code length of its symbol.  The code tables are indexed by
+// (unsigned char) value, with PSEUDO_EOF at index 256.
+//
+void _buildCodeLengths(const HuffmanTree &tree, uint16_t node,
+                       HuffmanCode codes[PSEUDO_EOF + 1], int depth) {
+    if (tree.isLeaf(node)) {  // if leaf node
+        int character = tree[node].character;
+        int index = (character == PSEUDO_EOF) ? PSEUDO_EOF : (unsigned char)character;
+        codes[index].length = depth;
+        return;
     }
+    if (tree[node].zero != HuffmanTree::NO_NODE)
+        _buildCodeLengths(tree, tree[node].zero, codes, depth + 1);
+    if (tree[node].one != HuffmanTree::NO_NODE)
+        _buildCodeLengths(tree, tree[node].one, codes, depth + 1);
 }
 
 //
-// This function builds the encoding map from an encoding tree.
+// Returns the string form of a code: one '0' or '1' char per bit, in the
+// order they are written.
 //
-hashmapE buildEncodingMap(HuffmanNode* tree) {
-    hashmapE encodingMap;
-    if (!tree)  // if nullptr return empty encodingMap
-        return encodingMap;
+string _codeString(const HuffmanCode &code) {
     string str = "";
-    _buildEncodingMap(tree, encodingMap, str);  // helper function called
+    for (int bit = 0; bit < code.length; bit++) {
+        str += ((code.bits >> bit) & 1) ? "1" : "0";
+    }
+    return str;
+}
+
+//
+// This function builds the encoding map from an encoding tree.  Only the
+// depth of each leaf is taken from the tree; the codes themselves are the
+// canonical codes for those lengths.  A tree that is a lone leaf gives no
+// codes.
+//
+EncodingTable buildEncodingMap(const HuffmanTree &tree) {
+    EncodingTable encodingMap;
+    if (tree.empty() || tree.isLeaf(tree.root()))
+        return encodingMap;
+    _buildCodeLengths(tree, tree.root(), encodingMap.codes, 0);
+    buildCanonicalCodes(encodingMap.codes);
     return encodingMap;
 }
 
+//
+// This function appends the codes of the length chars starting at data to
+// str as '0'/'1' chars.
+//
+void _appendCodeString(const char* data, size_t length,
+                       const HuffmanCode table[PSEUDO_EOF + 1], string &str) {
+    string codeStrings[256];
+    for (int i = 0; i < 256; i++) {
+        codeStrings[i] = _codeString(table[i]);
+    }
+    for (size_t i = 0; i < length; i++) {
+        str += codeStrings[(unsigned char)data[i]];  // add encodings of each char to str
+    }
+}
+
+//
+// This function encodes the length chars starting at data into the output
+// stream using the code table, followed by PSEUDO_EOF.  See encode below
+// for the other parameters.
+//
+string _encode(const char* data, size_t length,
+               const HuffmanCode table[PSEUDO_EOF + 1], ofbitstream& output,
+               size_t &size, bool makeFile, bool makeString) {
+    string str = "";
+    size_t bits = table[PSEUDO_EOF].length;
+    if (makeFile) {
+        // several symbols per step, merged before they are written
+        bits += encodeSymbols((const unsigned char*)data, length, table, output);
+        writeCode(output, table[PSEUDO_EOF]);
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            bits += table[(unsigned char)data[i]].length;
+        }
+    }
+    if (makeString) {  // the debug view: one '0'/'1' char per output bit
+        str.reserve(bits);
+        _appendCodeString(data, length, table, str);
+        str += _codeString(table[PSEUDO_EOF]);
+    }
+    size += bits;  // adds the number of bits written to size
+    return str;
+}
+
+//
+// This function encodes the length chars starting at data into the output
+// stream using the encodingMap.  This function calculates the number of bits
+// written to the output stream and adds it to the size parameter, which is
+// passed by reference.  The codes are packed straight into the output
+// buffer; only if makeString is true is a string representation of the
+// output built and returned as well, which is particularly useful for
+// testing.  Otherwise the empty string is returned.
+//
+string encode(const char* data, size_t length, const EncodingTable &encodingMap,
+              ofbitstream& output, size_t &size, bool makeFile,
+              bool makeString = false) {
+    return _encode(data, length, encodingMap.codes, output, size, makeFile,
+                   makeString);
+}
+
 //
 // This function encodes the data in the input stream into the output stream
-// using the encodingMap.  This function calculates the number of bits
-// written to the output stream and sets result to the size parameter, which is
-// passed by reference.  This function also returns a string representation of
-// the output file, which is particularly useful for testing.
+// using the encodingMap.  See above for size, makeString and the returned
+// string.
+//
+string encode(ifstream& input, const EncodingTable &encodingMap, ofbitstream& output,
+              size_t &size, bool makeFile, bool makeString = false) {
+    string data((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    return encode(data.data(), data.length(), encodingMap, output, size,
+                  makeFile, makeString);
+}
+
+//
+// Recursive helper function that collects the code of every leaf of the
+// tree, packed the same way as the encoder's table.  bits holds the path
+// so far, first step in the lowest bit.  Files with a frequency-map header
+// were coded with these tree-shaped codes rather than canonical ones.
+//
+void _buildTreeCodes(const HuffmanTree &tree, uint16_t node,
+                     HuffmanCode codes[PSEUDO_EOF + 1], uint64_t bits, int depth) {
+    if (tree.isLeaf(node)) {  // if leaf node
+        int character = tree[node].character;
+        int index = (character == PSEUDO_EOF) ? PSEUDO_EOF : (unsigned char)character;
+        codes[index].bits = bits;
+        codes[index].length = depth;
+        return;
+    }
+    if (depth >= 64)  // deeper than a code can be packed; left uncoded
+        return;
+    if (tree[node].zero != HuffmanTree::NO_NODE)
+        _buildTreeCodes(tree, tree[node].zero, codes, bits, depth + 1);
+    if (tree[node].one != HuffmanTree::NO_NODE)
+        _buildTreeCodes(tree, tree[node].one, codes, bits | (1ULL << depth), depth + 1);
+}
+
+//
+// Helper function for decoding by walking the tree one bit at a time.  It
+// is only used for trees whose codes are too long for a decodetable.
+// BitInput is anything with hasBits and readBits, i.e. an ibitstream or a
+// bitreader over a mapped file.
+//
+template <typename BitInput>
+void _decodeTree(BitInput &input, const HuffmanTree &encodingTree, string &out) {
+    uint16_t tmp = encodingTree.root();
+    while (input.hasBits()) {
+        if (input.readBits(1))
+            tmp = encodingTree[tmp].one;
+        else
+            tmp = encodingTree[tmp].zero;
+        if (tmp == HuffmanTree::NO_NODE)  // corrupt input
+            break;
+        if (encodingTree.isLeaf(tmp)) {  //.if leaf node
+            if (encodingTree[tmp].character == PSEUDO_EOF)  // if EOF then break
+                break;
+            out += (char)encodingTree[tmp].character;
+            tmp = encodingTree.root();  // move tmp back up to the root
+        }
+    }
+}
+
+//
+// Helper function for decoding.  Decodes symbols with a lookup table built
+// from codes until PSEUDO_EOF (or the end of the input), writing them to
+// output in large chunks.  If makeString is true, they are also collected
+// in the returned string.  Codes too long for the table are only possible
+// in old files; for those, encodingTree is walked instead if it is given.
+// sizeHint, the original size if known, is only used to reserve the string.
 //
-string encode(ifstream& input, hashmapE &encodingMap, ofbitstream& output, int &size, bool makeFile) {
+template <typename BitInput>
+string _decode(BitInput &input, const HuffmanCode codes[PSEUDO_EOF + 1],
+               ostream &output, bool makeString,
+               const HuffmanTree* encodingTree = nullptr, uint64_t sizeHint = 0) {
     string str = "";
-    char character;
-    while (input.get(character)) {
-        str += encodingMap[character];  // add encodings of each char to str
-    }
-    str += encodingMap[PSEUDO_EOF];
-    if (makeFile) {  // if we have to make a file
-        for (auto &bite: str) {
-            // loop through str which has the encodings and write it into
-            // the output file one by one.
-            output.writeBit(bite - '0');
-        }   
-    }
-    size += str.length();  // adds the number of bits written to size
+    string chunk;
+    if (makeString)
+        str.reserve((size_t)sizeHint);
+    decodetable table;
+    if (!table.build(codes, PSEUDO_EOF + 1)) {
+        if (encodingTree != nullptr && !encodingTree->empty())
+            _decodeTree(input, *encodingTree, chunk);
+        output.write(chunk.data(), chunk.length());
+        return makeString ? chunk : str;
+    }
+    if (table.longestCode() == 0)  // no codes, or only PSEUDO_EOF
+        return str;
+    const size_t CHUNK_SIZE = 1 << 16;
+    chunk.resize(CHUNK_SIZE);
+    bool ended = false;  // PSEUDO_EOF (or corrupt input) reached
+    int last = 0;
+    while (!ended) {
+        // up to three symbols per table lookup
+        size_t used = table.decodeBytes(input, (unsigned char*)&chunk[0],
+                                        CHUNK_SIZE, ended, last);
+        output.write(chunk.data(), used);
+        if (makeString)
+            str.append(chunk, 0, used);
+        if (used < CHUNK_SIZE && !ended)  // input ran out without PSEUDO_EOF
+            break;
+    }
     return str;
 }
 
 //
 // This function decodes the input stream and writes the result to the output
-// stream using the encodingTree.  This function also returns a string
-// representation of the output file, which is particularly useful for testing.
+// stream using the encodingTree, whose leaf depths give the canonical codes
+// the encoder used.  If makeString is true, this function also returns a
+// string representation of the output file, which is particularly useful for
+// testing; otherwise it returns the empty string.
 //
-string decode(ifbitstream &input, HuffmanNode* encodingTree, ofstream &output) {
-    string str = "";
-    HuffmanNode* tmp = encodingTree;
-    int bit = 0;
-    while (bit != PSEUDO_EOF) {
-        bit = input.readBit();  // keeps on getting the chars
-        if (bit == 1)
-            tmp = tmp->one;
-        if (bit == 0)
-            tmp = tmp->zero;
-        if (!tmp->one && !tmp->zero) {  //.if leaf node
-            if (tmp->character == PSEUDO_EOF)  // if EOF then break
-                break;
-            // otherwise add the char to str and output
-            str += (char)tmp->character;
-            output << (char)tmp->character;
-            // move tmp back up to the root
-            tmp = encodingTree;
+string decode(ifbitstream &input, const HuffmanTree &encodingTree, ofstream &output,
+              bool makeString = false) {
+    if (encodingTree.empty())
+        return "";
+    HuffmanCode codes[PSEUDO_EOF + 1] = {};
+    _buildCodeLengths(encodingTree, encodingTree.root(), codes, 0);
+    buildCanonicalCodes(codes);
+    return _decode(input, codes, output, makeString);
+}
+
+//
+// This function codes one block of a version 2 file (see container.h):
+// the length chars starting at data, at least one, get a code of their own
+// and go to block as the block's sizes, code lengths and bits.  If
+// interleaved is true, the bits are INTERLEAVED_STREAMS streams after
+// their jump table.  bits collects the bits until their size is known;
+// passing the same writer for every block reuses its buffer.  If
+// makeString is true, the codes are also appended to str as '0'/'1' chars.
+// If stats is given, the block's counts and stage times are added to it.
+//
+void _encodeBlock(const char* data, size_t length, int maxCodeLength,
+                  bool interleaved, bitwriter &bits, string &block,
+                  bool makeString, string &str, CodingStats* stats = nullptr) {
+    stagetimer timer(stats);
+    uint64_t counts[PSEUDO_EOF + 1] = {};
+    byteHistogram((const unsigned char*)data, length, counts);
+    timer.lap(&CodingStats::countSeconds);
+    HuffmanCode codes[PSEUDO_EOF + 1];
+    _blockCodeLengths(data, counts, maxCodeLength, codes);
+    buildCanonicalCodes(codes);
+    timer.lap(&CodingStats::codeSeconds);
+    int nStreams = interleaved ? INTERLEAVED_STREAMS : 1;
+    size_t part = (length + nStreams - 1) / nStreams;
+    size_t ends[INTERLEAVED_STREAMS];  // where each stream ends in bits
+    bits.reset();
+    for (int k = 0; k < nStreams; k++) {
+        size_t start = min(k * part, length);
+        encodeSymbols((const unsigned char*)data + start,
+                      min(start + part, length) - start, codes, bits);
+        bits.finish();
+        ends[k] = bits.size();
+    }
+    ostringstream head;
+    writeVarint(head, length);
+    ostringstream jump;
+    for (int k = 0; k + 1 < nStreams; k++) {
+        writeVarint(jump, ends[k] - (k ? ends[k - 1] : 0));
+    }
+    writeVarint(head, jump.str().length() + bits.size());
+    writeCodeLengths(head, codes);
+    block = head.str();
+    block += jump.str();
+    block.append((const char*)bits.data(), bits.size());
+    if (makeString)
+        _appendCodeString(data, length, codes, str);
+    timer.lap(&CodingStats::encodeSeconds);
+    if (stats != nullptr) {
+        stats->symbols += length;
+        stats->codedBits += encodedBits(counts, codes);
+        stats->headerBytes += head.str().length() + jump.str().length();
+        stats->blocks++;
+    }
+}
+
+// A block being coded by _encodeBlocks, and the buffers that code it.
+struct _BlockSlot {
+    bitwriter bits;
+    string block;
+    string str;
+    CodingStats stats;
+    bool done;
+};
+
+// The buffers and tables compressing and decompressing a file work in.
+// Passing the same one for every file reuses them instead of allocating
+// new ones per file and per block.
+struct CoderBuffers {
+    vector<_BlockSlot> slots;
+    decodetable table;
+    string block;
+};
+
+//
+// Helper function for compress: codes the size chars at data in blocks of
+// blockSize and writes them to output, where the first starts at offset,
+// adding an entry for each to blocks.  Blocks are coded on
+// options.threads threads and written in order through a reorder buffer,
+// slots, that holds at most two blocks per thread, so memory does not
+// grow with the input.  If makeString is true, the codes are appended to
+// str.  If stats is given, the counts and stage times of the blocks and of
+// writing them are added to it.
+//
+void _encodeBlocks(const char* data, size_t size, uint64_t blockSize,
+                   const CompressOptions &options, ostream &output, uint64_t offset,
+                   vector<BlockEntry> &blocks, vector<_BlockSlot> &slots,
+                   bool makeString, string &str, CodingStats* stats = nullptr) {
+    size_t nBlocks = (size_t)((size + blockSize - 1) / blockSize);
+    int nThreads = options.threads > 0 ? options.threads : threadpool::defaultThreads();
+    if ((size_t)nThreads > nBlocks)
+        nThreads = (int)nBlocks;
+    // block i is coded in slots[i % window] while blocks before it are
+    // written
+    size_t window = nThreads > 1 ? 2 * (size_t)nThreads : 1;
+    if (slots.size() < window)
+        slots.resize(window);
+    mutex lock;
+    condition_variable ready;
+    unique_ptr<threadpool> pool;  // joined before the slots go away
+    if (nThreads > 1)
+        pool.reset(new threadpool(nThreads));
+    size_t submitted = 0;
+    for (size_t i = 0; i < nBlocks; i++) {
+        for (; submitted < nBlocks && submitted < i + window; submitted++) {
+            _BlockSlot* slot = &slots[submitted % window];
+            slot->done = false;
+            slot->stats = CodingStats();
+            size_t start = submitted * (size_t)blockSize;
+            size_t length = (size_t)min((uint64_t)(size - start), blockSize);
+            function<void()> job = [&, slot, start, length]() {
+                _encodeBlock(data + start, length, options.maxCodeLength,
+                             options.interleaved, slot->bits, slot->block,
+                             makeString, slot->str, stats ? &slot->stats : nullptr);
+                lock_guard<mutex> guard(lock);
+                slot->done = true;
+                ready.notify_all();
+            };
+            if (pool)
+                pool->submit(job);
+            else
+                job();
+        }
+        _BlockSlot &slot = slots[i % window];
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [&slot] { return slot.done; });
+        }
+        stagetimer timer(stats);
+        output.write(slot.block.data(), slot.block.length());
+        timer.lap(&CodingStats::writeSeconds);
+        if (stats != nullptr)
+            stats->add(slot.stats);
+        size_t length = (size_t)min((uint64_t)(size - i * (size_t)blockSize), blockSize);
+        BlockEntry entry = {offset, slot.block.length(), length};
+        blocks.push_back(entry);
+        offset += slot.block.length();
+        if (makeString) {
+            str += slot.str;
+            slot.str.clear();
+        }
+    }
+}
+
+//
+// This function decodes one block of a version 2 file, the size bytes at
+// data, into out, building its decoding tables in table; interleaved tells
+// whether it was coded as several streams.  Returns false if the block is
+// damaged or decodes to more than maxSize bytes.  If stats is given, the
+// block's counts and stage times are added to it.
+//
+bool _decodeBlock(const unsigned char* data, size_t size, uint64_t maxSize,
+                  bool interleaved, decodetable &table, string &out,
+                  CodingStats* stats = nullptr) {
+    stagetimer timer(stats);
+    spanbuf buf(data, size);
+    istream in(&buf);
+    uint64_t rawSize, codedSize;
+    HuffmanCode codes[PSEUDO_EOF + 1];
+    if (!readVarint(in, rawSize) || !readVarint(in, codedSize)
+        || !readCodeLengths(in, codes))
+        return false;
+    streamoff offset = in.tellg();
+    if (rawSize == 0 || rawSize > maxSize || offset < 0
+        || codedSize != size - (size_t)offset)
+        return false;
+    buildCanonicalCodes(codes);
+    if (!table.build(codes, PSEUDO_EOF + 1) || table.longestCode() == 0)
+        return false;
+    timer.lap(&CodingStats::codeSeconds);
+    if (stats != nullptr) {
+        stats->symbols += rawSize;
+        stats->codedBits += 8 * codedSize;
+        stats->headerBytes += size - codedSize;
+        stats->blocks++;
+    }
+    out.resize((size_t)rawSize);
+    bool ended;
+    int last;
+    if (!interleaved) {
+        bitreader input;
+        input.setSpan(data + offset, data + size);
+        bool ok = table.decodeBytes(input, (unsigned char*)&out[0], out.size(),
+                                    ended, last) == out.size();
+        timer.lap(&CodingStats::decodeSeconds);
+        return ok;
+    }
+    // the jump table, then the streams one after the other
+    uint64_t sizes[INTERLEAVED_STREAMS];
+    uint64_t total = 0;
+    for (int k = 0; k + 1 < INTERLEAVED_STREAMS; k++) {
+        if (!readVarint(in, sizes[k]))
+            return false;
+        total += sizes[k];
+    }
+    streamoff streams = in.tellg();
+    if (streams < 0 || total > size - (size_t)streams)
+        return false;
+    sizes[INTERLEAVED_STREAMS - 1] = size - (size_t)streams - total;
+    if (stats != nullptr) {  // the jump table is head, not code
+        stats->codedBits -= 8 * (uint64_t)(streams - offset);
+        stats->headerBytes += (uint64_t)(streams - offset);
+    }
+    bitreader inputs[INTERLEAVED_STREAMS];
+    unsigned char* outs[INTERLEAVED_STREAMS];
+    size_t counts[INTERLEAVED_STREAMS];
+    size_t part = (out.size() + INTERLEAVED_STREAMS - 1) / INTERLEAVED_STREAMS;
+    const unsigned char* next = data + streams;
+    for (int k = 0; k < INTERLEAVED_STREAMS; k++) {
+        inputs[k].setSpan(next, next + sizes[k]);
+        next += sizes[k];
+        size_t start = min(k * part, out.size());
+        outs[k] = (unsigned char*)&out[0] + start;
+        counts[k] = min(start + part, out.size()) - start;
+    }
+    bool ok = table.decodeStreams<INTERLEAVED_STREAMS>(inputs, outs, counts);
+    timer.lap(&CodingStats::decodeSeconds);
+    return ok;
+}
+
+//
+// Helper function for decompress: decodes the blocks of the version 2
+// file mapped by source, the first of which starts at firstBlock, to
+// output; interleaved is the INTERLEAVED_FLAG of its header.  If
+// makeString is true, the decoded bytes are also appended to str.  Every
+// block has its own code and the index says where each starts, so a
+// damaged block is left out and its number added to damaged, and the
+// blocks after it are still decoded.  Returns false if any block was
+// damaged, or if the index is, in which case nothing can be decoded.  If
+// stats is given, the counts and stage times of the blocks and of writing
+// them are added to it.
+//
+bool _decodeBlocks(const mappedfile &source, uint64_t firstBlock,
+                   uint64_t blockSize, bool interleaved, ostream &output,
+                   CoderBuffers &buffers, bool makeString, string &str,
+                   vector<size_t> &damaged, CodingStats* stats = nullptr) {
+    vector<BlockEntry> blocks;
+    if (!readBlockIndex(source.data(), source.size(), firstBlock, blocks))
+        return false;
+    if (makeString)
+        str.reserve(str.size() + (size_t)(blocks.size() * blockSize));
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const BlockEntry &entry = blocks[i];
+        if (!_decodeBlock(source.data() + entry.offset, (size_t)entry.storedSize,
+                          blockSize, interleaved, buffers.table, buffers.block, stats)
+            || buffers.block.size() != entry.rawSize) {
+            damaged.push_back(i);
             continue;
         }
+        stagetimer timer(stats);
+        output.write(buffers.block.data(), buffers.block.size());
+        timer.lap(&CodingStats::writeSeconds);
+        if (makeString)
+            str += buffers.block;
     }
-    return str;
+    return damaged.empty();
 }
 
 //
-// This function completes the entire compression process.  Given a file,
-// filename, this function (1) builds a frequency map; (2) builds an encoding
-// tree; (3) builds an encoding map; (4) encodes the file (don't forget to
-// include the frequency map in the header of the output file).  This function
-// should create a compressed file named (filename + ".huf") and should also
-// return a string version of the bit pattern.
-//
-string compress(string filename) {
-    hashmapF frequencyMap;
-    HuffmanNode* encodingTree = nullptr;
-    hashmapE encodingMap;
-    buildFrequencyMap(filename, true, frequencyMap);
-    encodingTree = buildEncodingTree(frequencyMap);
-    encodingMap = buildEncodingMap(encodingTree);
-    ofbitstream output(filename + ".huf");
-    ifstream input(filename);
-    stringstream stream;
-    stream << frequencyMap;
-    output << frequencyMap;
-    int size = 0;
-    string compressedString = encode(input, encodingMap, output, size, true);
+// Helper function for compress: compresses the file source into the file
+// target in the current format, working in buffers.  If makeString is
+// true, the bit patterns of all blocks are appended to str.  If stats is
+// given, the counts and stage times are added to it.  Returns false if
+// source cannot be read or target cannot be written.
+//
+bool _compressFile(const string &source, const string &target,
+                   const CompressOptions &options, CoderBuffers &buffers,
+                   bool makeString, string &str, CodingStats* stats = nullptr) {
+    stagetimer timer(stats);
+    // one mapping serves both the counting and the encoding pass
+    mappedfile input(source);
+    if (!input.is_open())
+        return false;
+    if (stats != nullptr)
+        input.prefault();  // so that reading is timed as such, not as counting
+    timer.lap(&CodingStats::readSeconds);
+    ContainerHeader header = {};
+    header.version = CONTAINER_VERSION;
+    header.flags = options.interleaved ? INTERLEAVED_FLAG : 0;
+    header.blockSize = min(max(options.blockSize, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+    ostringstream head;
+    writeHeader(head, header);
+    ofbitstream output(target);
+    output.write(head.str().data(), head.str().length());
+    uint64_t offset = head.str().length();
+    vector<BlockEntry> blocks;
+    _encodeBlocks((const char*)input.data(), input.size(), header.blockSize, options,
+                  output, offset, blocks, buffers.slots, makeString, str, stats);
+    if (!blocks.empty())
+        offset = blocks.back().offset + blocks.back().storedSize;
+    ostringstream tail;
+    writeBlockIndex(tail, blocks, offset);
+    timer = stagetimer(stats);
+    output.write(tail.str().data(), tail.str().length());
+    output.close();
+    timer.lap(&CodingStats::writeSeconds);
+    if (stats != nullptr) {
+        stats->bytesIn += input.size();
+        stats->bytesOut += offset + tail.str().length();
+        stats->headerBytes += head.str().length() + tail.str().length();
+    }
+    return !output.fail();
+}
+
+//
+// Helper function for decompress: decompresses the file source, in any
+// format this code has written, into the file target, working in buffers.
+// If makeString is true, the decoded bytes are also appended to str.
+// Returns false if source cannot be read or is not a compressed file, or
+// target cannot be written.  Files that are damaged further in are
+// decoded as far as they can be, and false is returned if that is
+// noticed; for the block format, the numbers of the blocks left out are
+// added to damaged if it is given.  If stats is given, the counts and
+// stage times are added to it; files in the older formats are timed as a
+// whole, as decoding.
+//
+bool _decompressFile(const string &source, const string &target,
+                     CoderBuffers &buffers, bool makeString, string &str,
+                     vector<size_t>* damaged = nullptr, CodingStats* stats = nullptr) {
+    stagetimer timer(stats);
+    mappedfile input(source);  // opens this file for reading
+    if (!input.is_open())
+        return false;
+    if (stats != nullptr)
+        input.prefault();  // so that reading is timed as such, not as counting
+    timer.lap(&CodingStats::readSeconds);
+    if (stats != nullptr)
+        stats->bytesIn += input.size();
+    spanbuf buf(input.data(), input.size());
+    istream headerIn(&buf);
+    ContainerHeader header = {};
+    HuffmanTree encodingTree;
+    if (headerIn.peek() == '{') {  // old text header
+        vector<pair<int, int>> counts;
+        if (!readFrequencyHeader(headerIn, counts))
+            return false;
+        _buildLegacyTree(counts, encodingTree);
+        if (!encodingTree.empty())
+            _buildTreeCodes(encodingTree, encodingTree.root(), header.codes, 0, 0);
+    } else if (!readHeader(headerIn, header)) {
+        return false;  // not a compressed file, or a newer version
+    } else if (header.version != CONTAINER_VERSION) {
+        buildCanonicalCodes(header.codes);
+    }
+    // created only now, so that input that is not a compressed file leaves
+    // nothing behind
+    ofstream output(target);
+    if (header.version == CONTAINER_VERSION) {
+        CodingStats blockStats;
+        vector<size_t> skipped;
+        bool ok = _decodeBlocks(input, (uint64_t)headerIn.tellg(), header.blockSize,
+                                (header.flags & INTERLEAVED_FLAG) != 0, output,
+                                buffers, makeString, str, skipped,
+                                stats ? &blockStats : nullptr);
+        if (damaged != nullptr)
+            damaged->insert(damaged->end(), skipped.begin(), skipped.end());
+        timer = stagetimer(stats);
+        output.close();
+        timer.lap(&CodingStats::writeSeconds);
+        if (stats != nullptr) {
+            stats->add(blockStats);
+            stats->bytesOut += blockStats.symbols;
+            // the file header, the end marker, the index and the trailer
+            stats->headerBytes += input.size() - blockStats.codedBits / 8
+                                - blockStats.headerBytes;
+        }
+        return ok && !output.fail();
+    }
+    streamoff offset = headerIn.tellg();
+    bitreader bits;  // the encoded bits are read in place from the mapping
+    bits.setSpan(input.data() + (offset < 0 ? input.size() : (size_t)offset),
+                 input.end());
+    str += _decode(bits, header.codes, output, makeString, &encodingTree,
+                   header.originalSize);
+    if (stats != nullptr) {
+        uint64_t written = output.tellp() < 0 ? 0 : (uint64_t)output.tellp();
+        uint64_t headerSize = offset < 0 ? input.size() : (uint64_t)offset;
+        stats->bytesOut += written;
+        stats->symbols += written;
+        stats->codedBits += 8 * (input.size() - headerSize);
+        stats->headerBytes += headerSize;
+    }
     output.close();
-    freeTree(encodingTree);
+    timer.lap(&CodingStats::decodeSeconds);
+    return !output.fail();
+}
+
+//
+// This function returns the name decompress gives the file it decodes
+// filename to: if filename = "example.txt.huf", it is "example_unc.txt".
+// The extension starts at the first '.' of the file's own name.
+//
+string _decompressedName(string filename) {
+    size_t pos = filename.find(".huf");
+    if ((int)pos >= 0) {
+        filename = filename.substr(0, pos);
+    }
+    size_t slash = filename.find_last_of('/');
+    pos = filename.find(".", slash == string::npos ? 0 : slash + 1);
+    if (pos == string::npos)
+        return filename + "_unc";
+    return filename.substr(0, pos) + "_unc" + filename.substr(pos);
+}
+
+//
+// This function completes the entire compression process.  Given a file,
+// filename, this function splits it into blocks of options.blockSize bytes
+// and, on options.threads threads, for each block (1) counts its bytes;
+// (2) computes the code lengths, without building a tree; (3) assigns
+// canonical codes for them; (4) encodes the block after its code lengths.
+// An index of the blocks ends the file (see container.h).  This function
+// should create a compressed file named (filename + ".huf").  If
+// makeString is true it also returns a string version of the bit patterns
+// of all blocks, which costs one byte of memory per output bit; otherwise
+// it returns the empty string.  options tune how the file is coded.  If
+// stats is given, it is filled in with the sizes and the time each stage
+// took (see stats.h).  If filename cannot be read or the compressed file
+// cannot be written, an error saying so is printed to cerr; succeeded, if
+// given, is set to whether the file was compressed.
+//
+string compress(string filename, bool makeString = false,
+                const CompressOptions &options = CompressOptions(),
+                CodingStats* stats = nullptr, bool* succeeded = nullptr) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (stats != nullptr)
+        *stats = CodingStats();
+    CoderBuffers buffers;
+    string compressedString;
+    bool ok = _compressFile(filename, filename + ".huf", options, buffers,
+                            makeString, compressedString, stats);
+    if (!ok)
+        cerr << "Cannot compress " << filename << " to " << filename << ".huf" << endl;
+    if (succeeded != nullptr)
+        *succeeded = ok;
+    if (stats != nullptr)
+        stats->totalSeconds =
+            chrono::duration<double>(chrono::steady_clock::now() - start).count();
     return compressedString;
 }
 
 //
 // This function completes the entire decompression process.  Given the file,
-// filename (which should end with ".huf"), (1) extract the header and build
-// the frequency map; (2) build an encoding tree from the frequency map; (3)
-// using the encoding tree to decode the file.  This function should create a
+// filename (which should end with ".huf"), (1) read the header and the
+// block index; (2) for each block, assign the canonical codes for its code
+// lengths and build the decoding tables from them; (3) decode the block.
+// Files from older versions are still read: those with one code for the
+// whole file are decoded in one go after its header, and for those with a
+// frequency-map header the tree is rebuilt from the map, since its shape
+// gave the codes.  This function should create a
 // compressed file using the following convention.
 // If filename = "example.txt.huf", then the uncompressed file should be named
-// "example_unc.txt".  The function should return a string version of the
-// uncompressed file.  Note this function should reverse what the compress
-// function did.
+// "example_unc.txt".  If makeString is true, the function also returns a
+// string version of the uncompressed file; otherwise it returns the empty
+// string.  If stats is given, it is filled in as by compress.  If the file
+// cannot be decompressed, or only in part because some blocks are damaged,
+// an error saying so is printed to cerr; succeeded, if given, is set to
+// whether all of it was.  Note this function should reverse what the
+// compress function did.
 //
-string decompress(string filename) {
+string decompress(string filename, bool makeString = false,
+                  CodingStats* stats = nullptr, bool* succeeded = nullptr) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (stats != nullptr)
+        *stats = CodingStats();
     size_t pos = filename.find(".huf");
     if ((int)pos >= 0) {
         filename = filename.substr(0, pos);
     }
-    pos = filename.find(".");
-    string ext = filename.substr(pos, filename.length() - pos);
-    filename = filename.substr(0, pos);
-    ifbitstream input(filename + ext + ".huf");  // opens this file for reading
-    ofstream output(filename + "_unc" + ext);  // creates this file for output
-    hashmapF header;
-    input >> header;  // makes the frequency map using the >> operator
-    HuffmanNode* encodingTree = buildEncodingTree(header);
-    string decodeStr  = decode(input, encodingTree, output);
-    output.close();
-    freeTree(encodingTree);
+    CoderBuffers buffers;
+    string decodeStr;
+    vector<size_t> damaged;
+    bool ok = _decompressFile(filename + ".huf", _decompressedName(filename), buffers,
+                              makeString, decodeStr, &damaged, stats);
+    if (succeeded != nullptr)
+        *succeeded = ok;
+    if (!ok) {
+        cerr << "Cannot decompress " << filename << ".huf";
+        if (!damaged.empty()) {
+            cerr << " in full: damaged block" << (damaged.size() > 1 ? "s" : "");
+            for (size_t i = 0; i < damaged.size(); i++) {
+                cerr << (i ? ", " : " ") << damaged[i];
+            }
+            cerr << " left out";
+        }
+        cerr << endl;
+    }
+    if (stats != nullptr)
+        stats->totalSeconds =
+            chrono::duration<double>(chrono::steady_clock::now() - start).count();
     return decodeStr;
 }